@@ -20,32 +20,81 @@
 #include "FACT_vm.h"
 #include "FACT_error.h"
 #include "FACT_alloc.h"
+#include "FACT_num.h"
 #include "FACT_hash.h"
 #include "FACT_threads.h"
 #include "FACT_strs.h"
+#include "FACT_vec.h"
+#include "FACT_dict.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <limits.h>
 
 /* Macros for declaring FACT BIFs. */
 #define FBIF(name) { #name, &FBIF_##name }
 #define FBIF_DEC(name) static void FBIF_##name (void)
 
 static void *get_arg (FACT_type);
+static size_t get_size_arg (void);
+static FACT_dict_t get_dict_arg (bool);
 
 FBIF_DEC (floor);
 FBIF_DEC (print);
 FBIF_DEC (str);
 FBIF_DEC (size);
+FBIF_DEC (cat);
+FBIF_DEC (substr);
+FBIF_DEC (find);
+FBIF_DEC (split);
+FBIF_DEC (join);
+FBIF_DEC (replace);
+FBIF_DEC (trim);
+FBIF_DEC (parse);
 FBIF_DEC (error);
 FBIF_DEC (throw);
 FBIF_DEC (send);
 FBIF_DEC (receive);
+FBIF_DEC (try_receive);
+FBIF_DEC (receive_for);
+FBIF_DEC (receive_batch);
 FBIF_DEC (parcels);
+FBIF_DEC (pmap);
+FBIF_DEC (preduce);
+FBIF_DEC (spawn);
+FBIF_DEC (spawnv);
+FBIF_DEC (await);
 FBIF_DEC (exit);
 FBIF_DEC (load);
 FBIF_DEC (ID);
+FBIF_DEC (vadd);
+FBIF_DEC (vsub);
+FBIF_DEC (vmul);
+FBIF_DEC (vdiv);
+FBIF_DEC (veq);
+FBIF_DEC (vne);
+FBIF_DEC (vlt);
+FBIF_DEC (vle);
+FBIF_DEC (vgt);
+FBIF_DEC (vge);
+FBIF_DEC (vsum);
+FBIF_DEC (vmin);
+FBIF_DEC (vmax);
+FBIF_DEC (vmean);
+FBIF_DEC (vdot);
+FBIF_DEC (vscan);
+FBIF_DEC (vfill);
+FBIF_DEC (vcopy);
+FBIF_DEC (vslice);
+FBIF_DEC (dict);
+FBIF_DEC (dget);
+FBIF_DEC (dput);
+FBIF_DEC (dhas);
+FBIF_DEC (ddel);
+FBIF_DEC (dkeys);
+FBIF_DEC (dsize);
 
 static const struct {
   char *name;
@@ -55,13 +104,56 @@ static const struct {
   FBIF (print),
   FBIF (str),
   FBIF (size),
+  FBIF (cat),
+  FBIF (substr),
+  FBIF (find),
+  FBIF (split),
+  FBIF (join),
+  FBIF (replace),
+  FBIF (trim),
+  FBIF (parse),
   FBIF (error),
   FBIF (throw),
   FBIF (send),
   FBIF (receive),
+  FBIF (try_receive),
+  FBIF (receive_for),
+  FBIF (receive_batch),
+  FBIF (parcels),
+  FBIF (pmap),
+  FBIF (preduce),
+  FBIF (spawn),
+  FBIF (spawnv),
+  FBIF (await),
   FBIF (ID),
   FBIF (exit),
   FBIF (load),
+  FBIF (vadd),
+  FBIF (vsub),
+  FBIF (vmul),
+  FBIF (vdiv),
+  FBIF (veq),
+  FBIF (vne),
+  FBIF (vlt),
+  FBIF (vle),
+  FBIF (vgt),
+  FBIF (vge),
+  FBIF (vsum),
+  FBIF (vmin),
+  FBIF (vmax),
+  FBIF (vmean),
+  FBIF (vdot),
+  FBIF (vscan),
+  FBIF (vfill),
+  FBIF (vcopy),
+  FBIF (vslice),
+  FBIF (dict),
+  FBIF (dget),
+  FBIF (dput),
+  FBIF (dhas),
+  FBIF (ddel),
+  FBIF (dkeys),
+  FBIF (dsize),
 };
 
 #define NUM_FBIF ((sizeof BIF_list) / (sizeof BIF_list[0]))
@@ -76,6 +168,7 @@ void FACT_add_BIFs (void) /* Add the built-in functions to the global table. */
   FACT_scope_t temp;
 
   tvar.type = SCOPE_TYPE;
+  tvar.home = NULL;
   
   /* Add each of the functions. */
   for (i = 0; i < NUM_FBIF; i++) {
@@ -84,7 +177,7 @@ void FACT_add_BIFs (void) /* Add the built-in functions to the global table. */
     temp->lock_stat = HARD_LOCK;
     temp->extrn_func = BIF_list[i].phys;
     tvar.ap = temp;
-    FACT_add_to_table (&Furlow_globals, tvar);
+    Furlow_bind_global (tvar);
   }
 
   /* Well that was pretty easy. */
@@ -132,6 +225,8 @@ static void FBIF_print (void) /* Print an ASCII string or numerical value. */
    */
   if (arg->array_size == 0) /* Print a newline, as it is a number */
     len = printf("%s\n", mpc_get_str(arg->value)) - 1;
+  else if (arg->pack_type == PACK_BYTES || arg->pack_type == PACK_U8)
+    len = printf("%.*s", (int) strnlen(arg->pack, arg->array_size), (char *) arg->pack);
   else
     len = printf("%s", FACT_natos(arg));
   fflush(stdout);
@@ -162,6 +257,100 @@ static void FBIF_size (void) /* Return the size of an array. */
   push_v (push_val);
 }
 
+static void FBIF_cat (void) /* Concatenate two arrays or numbers. */
+{
+  FACT_t push_val;
+  FACT_num_t op1, op2;
+
+  op2 = GET_ARG_NUM ();
+  op1 = GET_ARG_NUM ();
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_concat_num (op1, op2);
+  push_v (push_val);
+}
+
+static void FBIF_substr (void) /* substr (s, start, len): get part of a string. */
+{
+  size_t len, start;
+  FACT_t push_val;
+
+  len = get_size_arg ();
+  start = get_size_arg ();
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_str_sub (GET_ARG_NUM (), start, len);
+  push_v (push_val);
+}
+
+static void FBIF_find (void) /* find (s, pat, start): index of pat in s from start on, or -1. */
+{
+  size_t res, start;
+  FACT_num_t str, pat;
+
+  start = get_size_arg ();
+  pat = GET_ARG_NUM ();
+  str = GET_ARG_NUM ();
+  res = FACT_str_find (str, pat, start);
+  if (res == FACT_NOT_FOUND)
+    push_constant_si (-1);
+  else
+    push_constant_ui (res);
+}
+
+static void FBIF_split (void) /* split (s, sep): split a string into an array of strings. */
+{
+  FACT_t push_val;
+  FACT_num_t str, sep;
+
+  sep = GET_ARG_NUM ();
+  str = GET_ARG_NUM ();
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_str_split (str, sep);
+  push_v (push_val);
+}
+
+static void FBIF_join (void) /* join (arr, sep): join an array of strings. */
+{
+  FACT_t push_val;
+  FACT_num_t arr, sep;
+
+  sep = GET_ARG_NUM ();
+  arr = GET_ARG_NUM ();
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_str_join (arr, sep);
+  push_v (push_val);
+}
+
+static void FBIF_replace (void) /* replace (s, old, new): replace every old in s with new. */
+{
+  FACT_t push_val;
+  FACT_num_t str, old, new;
+
+  new = GET_ARG_NUM ();
+  old = GET_ARG_NUM ();
+  str = GET_ARG_NUM ();
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_str_replace (str, old, new);
+  push_v (push_val);
+}
+
+static void FBIF_trim (void) /* Remove leading and trailing white space from a string. */
+{
+  FACT_t push_val;
+
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_str_trim (GET_ARG_NUM ());
+  push_v (push_val);
+}
+
+static void FBIF_parse (void) /* Convert a string to a number. */
+{
+  FACT_t push_val;
+
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_str_parse (GET_ARG_NUM ());
+  push_v (push_val);
+}
+
 static void FBIF_error (void) /* Return the current error message. */
 {
   FACT_t push_val;
@@ -181,10 +370,11 @@ static void FBIF_throw (void) /* Throw an error. */
 
 static void FBIF_send (void) /* Send a message to a thread. */
 {
-  FACT_num_t dest, msg;
+  FACT_t msg;
+  FACT_num_t dest;
 
   //  printf("entered\n");
-  msg = GET_ARG_NUM ();
+  msg = pop_v ();
   dest = GET_ARG_NUM ();
 
   FACT_send_message (msg, mpc_get_ui (dest->value));
@@ -196,11 +386,92 @@ static void FBIF_receive (void) /* Pop the current thread's message queue. */
   FACT_t res;
 
   res.type = SCOPE_TYPE;
+  res.home = NULL;
   res.ap = FACT_get_next_message ();
 
   push_v (res);
 }
 
+static void push_message (FACT_scope_t msg) /* Push a message, or 0 if there is none. */
+{
+  FACT_t res;
+
+  if (msg == NULL)
+    push_constant_ui (0);
+  else {
+    res.type = SCOPE_TYPE;
+    res.home = NULL;
+    res.ap = msg;
+    push_v (res);
+  }
+}
+
+static void FBIF_try_receive (void) /* Pop the message queue if it isn't empty. */
+{
+  push_message (FACT_try_next_message ());
+}
+
+static void FBIF_receive_for (void) /* Pop the message queue, waiting at most n ms. */
+{
+  push_message (FACT_wait_next_message (mpc_get_d (GET_ARG_NUM ()->value)));
+}
+
+static void FBIF_receive_batch (void) /* Pop up to n messages as [sender, message] pairs. */
+{
+  FACT_t res;
+
+  res.type = NUM_TYPE;
+  res.ap = FACT_get_messages (get_size_arg ());
+  push_v (res);
+}
+
+static void FBIF_parcels (void) /* Get the number of messages waiting. */
+{
+  push_constant_ui (FACT_count_messages ());
+}
+
+static void FBIF_pmap (void) /* Call a function on every element of an array, in parallel. */
+{
+  FACT_t res;
+  FACT_num_t arr;
+
+  arr = GET_ARG_NUM ();
+  res.type = NUM_TYPE;
+  res.ap = FACT_pmap (GET_ARG_SCOPE (), arr);
+  push_v (res);
+}
+
+static void FBIF_preduce (void) /* Fold an array with an associative function, in parallel. */
+{
+  FACT_t init;
+  FACT_num_t arr;
+
+  arr = GET_ARG_NUM ();
+  init = pop_v ();
+  push_v (FACT_preduce (GET_ARG_SCOPE (), init, arr));
+}
+
+static void FBIF_spawn (void) /* spawn (f, x): start a thread that calls f (x). */
+{
+  FACT_t arg;
+
+  arg = pop_v ();
+  push_constant_ui (FACT_spawn (GET_ARG_SCOPE (), arg, false));
+}
+
+static void FBIF_spawnv (void) /* spawnv (f, [a, b, ...]): start a thread that calls f (a, b, ...). */
+{
+  FACT_t args;
+
+  args = pop_v ();
+  push_constant_ui (FACT_spawn (GET_ARG_SCOPE (), args, true));
+}
+
+static void FBIF_await (void) /* Wait for a spawned thread to return. */
+{
+  push_v (FACT_await (get_size_arg ()));
+}
+
 static void FBIF_ID(void)
 {
   push_constant_ui(curr_thread->thread_num);
@@ -217,6 +488,223 @@ static void FBIF_load (void) /* Run a file in the current scope. */
   push_constant_ui (0);
 }
 
+/* Vector operations. The element-wise ones and the compares take an array
+ * and either another array of the same size or a number, and return a new
+ * array. The compares return a u8 array of 1s and 0s.
+ */
+#define VEC_ARITH_BIF(name, op)			\
+  static void FBIF_##name (void)		\
+  {						\
+    FACT_t push_val;				\
+    FACT_num_t a, b;				\
+						\
+    b = GET_ARG_NUM ();				\
+    a = GET_ARG_NUM ();				\
+    push_val.type = NUM_TYPE;			\
+    push_val.ap = FACT_vec_arith (op, a, b);	\
+    push_v (push_val);				\
+  }
+
+#define VEC_CMP_BIF(name, op)			\
+  static void FBIF_##name (void)		\
+  {						\
+    FACT_t push_val;				\
+    FACT_num_t a, b;				\
+						\
+    b = GET_ARG_NUM ();				\
+    a = GET_ARG_NUM ();				\
+    push_val.type = NUM_TYPE;			\
+    push_val.ap = FACT_vec_compare (op, a, b);	\
+    push_v (push_val);				\
+  }
+
+#define VEC_RED_BIF(name, red)				\
+  static void FBIF_##name (void)			\
+  {							\
+    FACT_t push_val;					\
+							\
+    push_val.type = NUM_TYPE;				\
+    push_val.ap = FACT_vec_reduce (red, GET_ARG_NUM ());	\
+    push_v (push_val);					\
+  }
+
+VEC_ARITH_BIF (vadd, VEC_ADD)
+VEC_ARITH_BIF (vsub, VEC_SUB)
+VEC_ARITH_BIF (vmul, VEC_MUL)
+VEC_ARITH_BIF (vdiv, VEC_DIV)
+
+VEC_CMP_BIF (veq, VEC_EQ)
+VEC_CMP_BIF (vne, VEC_NE)
+VEC_CMP_BIF (vlt, VEC_LT)
+VEC_CMP_BIF (vle, VEC_LE)
+VEC_CMP_BIF (vgt, VEC_GT)
+VEC_CMP_BIF (vge, VEC_GE)
+
+VEC_RED_BIF (vsum, VEC_SUM)
+VEC_RED_BIF (vmin, VEC_MIN)
+VEC_RED_BIF (vmax, VEC_MAX)
+VEC_RED_BIF (vmean, VEC_MEAN)
+
+static void FBIF_vdot (void) /* Dot product of two arrays. */
+{
+  FACT_t push_val;
+  FACT_num_t a, b;
+
+  b = GET_ARG_NUM ();
+  a = GET_ARG_NUM ();
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_vec_dot (a, b);
+  push_v (push_val);
+}
+
+static void FBIF_vscan (void) /* Prefix sums of an array. */
+{
+  FACT_t push_val;
+
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_vec_scan (GET_ARG_NUM ());
+  push_v (push_val);
+}
+
+static void FBIF_vfill (void) /* Set every element of an array, and return it. */
+{
+  FACT_t push_val;
+  FACT_num_t val;
+
+  val = GET_ARG_NUM ();
+  push_val.ap = GET_ARG_NUM ();
+  push_val.type = NUM_TYPE;
+  FACT_vec_fill (push_val.ap, val);
+  push_v (push_val);
+}
+
+static void FBIF_vcopy (void) /* Copy an array into the start of another, and return it. */
+{
+  size_t count;
+  FACT_t push_val;
+  FACT_num_t dst, src;
+
+  src = GET_ARG_NUM ();
+  dst = GET_ARG_NUM ();
+  count = (src->array_size < dst->array_size) ? src->array_size : dst->array_size;
+  FACT_vec_copy (dst, 0, src, 0, count);
+
+  push_val.type = NUM_TYPE;
+  push_val.ap = dst;
+  push_v (push_val);
+}
+
+static void FBIF_vslice (void) /* vslice (dst, dst_off, src, src_off, count): copy part of an array. */
+{
+  size_t count, dst_off, src_off;
+  FACT_t push_val;
+  FACT_num_t dst, src;
+
+  count = get_size_arg ();
+  src_off = get_size_arg ();
+  src = GET_ARG_NUM ();
+  dst_off = get_size_arg ();
+  dst = GET_ARG_NUM ();
+  FACT_vec_copy (dst, dst_off, src, src_off, count);
+
+  push_val.type = NUM_TYPE;
+  push_val.ap = dst;
+  push_v (push_val);
+}
+
+/* Dictionaries. dict () makes an empty one, and the rest take it as their
+ * first argument. Keys are numbers or arrays, and values are numbers or
+ * scopes.
+ */
+static void FBIF_dict (void) /* Make a new dictionary. */
+{
+  FACT_t push_val;
+
+  push_val.type = SCOPE_TYPE;
+  push_val.home = NULL;
+  push_val.ap = FACT_alloc_scope ();
+  ((FACT_scope_t) push_val.ap)->name = "dict";
+  ((FACT_scope_t) push_val.ap)->dict = FACT_new_dict ();
+  push_v (push_val);
+}
+
+static void FBIF_dget (void) /* dget (d, key): get the value of a key. */
+{
+  FACT_t *val;
+  FACT_num_t key;
+
+  key = GET_ARG_NUM ();
+  val = FACT_dict_get (get_dict_arg (false), key);
+  if (val == NULL)
+    FACT_throw_error (CURR_THIS, "key not found");
+  push_v (*val);
+}
+
+static void FBIF_dput (void) /* dput (d, key, value): set the value of a key, and return the value. */
+{
+  FACT_t val;
+  FACT_num_t key;
+
+  val = pop_v ();
+  key = GET_ARG_NUM ();
+  FACT_dict_put (get_dict_arg (true), key, val);
+  push_v (val);
+}
+
+static void FBIF_dhas (void) /* dhas (d, key): check if a key is in a dictionary. */
+{
+  FACT_num_t key;
+
+  key = GET_ARG_NUM ();
+  push_constant_ui (FACT_dict_get (get_dict_arg (false), key) != NULL);
+}
+
+static void FBIF_ddel (void) /* ddel (d, key): remove a key, returning 1 if it was there. */
+{
+  FACT_num_t key;
+
+  key = GET_ARG_NUM ();
+  push_constant_ui (FACT_dict_del (get_dict_arg (true), key));
+}
+
+static void FBIF_dkeys (void) /* Get an array of the keys of a dictionary. */
+{
+  FACT_t push_val;
+
+  push_val.type = NUM_TYPE;
+  push_val.ap = FACT_dict_keys (get_dict_arg (false));
+  push_v (push_val);
+}
+
+static void FBIF_dsize (void) /* Get the number of keys in a dictionary. */
+{
+  push_constant_ui (FACT_dict_size (get_dict_arg (false)));
+}
+
+static FACT_dict_t get_dict_arg (bool change) /* Get an argument that must be a dictionary. */
+{
+  FACT_scope_t arg;
+
+  arg = GET_ARG_SCOPE ();
+  if (arg->dict == NULL)
+    FACT_throw_error (CURR_THIS, "argument must be a dictionary");
+  if (change && arg->lock_stat != UNLOCKED)
+    FACT_throw_error (CURR_THIS, "cannot set immutable variable");
+  return arg->dict;
+}
+
+static size_t get_size_arg (void) /* Get an argument that must be a positive integer. */
+{
+  FACT_num_t arg;
+
+  arg = GET_ARG_NUM ();
+  if (mpc_is_float (arg->value)
+      || mpc_cmp_si (arg->value, 0) < 0
+      || mpc_cmp_ui (arg->value, ULONG_MAX) > 0)
+    FACT_throw_error (CURR_THIS, "argument must be a positive integer");
+  return mpc_get_ui (arg->value);
+}
+
 static void *get_arg (FACT_type type_of_arg) /* Get an argument. */
 {
   FACT_t pop_res;
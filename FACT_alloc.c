@@ -95,46 +95,104 @@ FACT_num_t FACT_alloc_num (void) /* Allocate and initialize a num type. */
 
 FACT_num_t *FACT_alloc_num_array (size_t n)
 {
+  size_t i;
   FACT_num_t *temp;
+  struct FACT_num *nodes;
 
-  temp = FACT_malloc (sizeof (FACT_num_t) * n); /* Allocate the nodes. */
+  temp = FACT_malloc (sizeof (FACT_num_t) * n);
+  nodes = FACT_malloc (sizeof (struct FACT_num) * n); /* Allocate the nodes. */
 
   /* Initialize all the nodes. */
-  do {
-    n--;
-    temp[n] = FACT_alloc_num ();
-  } while (n > 0);
+  for (i = 0; i < n; i++) {
+    temp[i] = nodes + i;
+    mpc_init (temp[i]->value);
+  }
 
   return temp;
 }
 
+/* The fields a scope points to are shared by every copy of the scope made
+ * with memcpy (up scopes, for instance), so they can't be stored in the
+ * scope itself. They are allocated in the same block as the scope instead.
+ */
+struct scope_data {
+  bool marked;
+  size_t array_size;
+  size_t array_cap;
+  size_t code;
+  FACT_table_t vars;
+  struct FACT_scope **array_up;
+};
+
+struct scope_block {
+  struct FACT_scope scope;
+  struct scope_data data;
+};
+
+static inline void set_scope_data (FACT_scope_t scope, struct scope_data *data)
+{
+  scope->marked = &data->marked;
+  scope->array_size = &data->array_size;
+  scope->array_cap = &data->array_cap;
+  scope->code = &data->code;
+  scope->vars = &data->vars;
+  scope->array_up = &data->array_up;
+}
+
+static inline void init_scope (struct scope_block *block)
+{
+  set_scope_data (&block->scope, &block->data);
+  block->scope.name = "lambda";
+  block->scope.lock_stat = UNLOCKED;
+}
+
 FACT_scope_t FACT_alloc_scope (void) /* Allocate and initialize a scope type. */
 {
-  FACT_scope_t temp;
-
-  /* Allocate the memory. */
-  temp = FACT_malloc (sizeof (struct FACT_scope));
-  temp->marked = FACT_malloc_atomic (sizeof (bool));
-  temp->array_size = FACT_malloc_atomic (sizeof (size_t));
-  temp->code = FACT_malloc_atomic (sizeof (size_t));
-  temp->vars = FACT_malloc (sizeof (FACT_table_t ));
-  temp->array_up = FACT_malloc (sizeof (FACT_scope_t **));
-  temp->name = "lambda";
-  temp->lock_stat = UNLOCKED;
+  struct scope_block *temp;
+
+  /* Allocate the memory, all in one go. */
+  temp = FACT_malloc (sizeof (struct scope_block));
+  init_scope (temp);
   
-  return temp;
+  return &temp->scope;
+}
+
+void FACT_recycle_scope (FACT_scope_t scope) /* Reset a scope from FACT_alloc_scope for reuse. */
+{
+  size_t num_slots, version;
+  FACT_t *slots;
+  struct scope_block *block;
+
+  block = (struct scope_block *) scope;
+
+  /* Keep the slot array around, but clear it so it holds on to nothing. */
+  slots = block->data.vars.slots;
+  num_slots = block->data.vars.num_slots;
+  if (slots != NULL)
+    memset (slots, 0, sizeof (FACT_t) * num_slots);
+
+  /* The version has to keep increasing, inline caches may remember it. */
+  version = block->data.vars.version;
+  memset (block, 0, sizeof (struct scope_block));
+  block->data.vars.slots = slots;
+  block->data.vars.num_slots = num_slots;
+  block->data.vars.version = version + 1;
+  init_scope (block);
 }
 
 FACT_scope_t *FACT_alloc_scope_array (size_t n)
 {
   FACT_scope_t *temp;
+  struct scope_block *nodes;
 
-  temp = FACT_malloc (sizeof (FACT_scope_t) * n); /* Allocate the nodes. */
+  temp = FACT_malloc (sizeof (FACT_scope_t) * n);
+  nodes = FACT_malloc (sizeof (struct scope_block) * n); /* Allocate the nodes. */
 
   /* Initialize all the nodes. */
   do {
     n--;
-    temp[n] = FACT_alloc_scope ();
+    init_scope (nodes + n);
+    temp[n] = &nodes[n].scope;
   } while (n > 0);
 
   return temp;
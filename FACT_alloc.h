@@ -47,6 +47,7 @@ typedef struct FACT_scope *FACT_scope_t;
 FACT_num_t FACT_alloc_num (void);              /* Allocate a number.            */
 FACT_num_t *FACT_alloc_num_array (size_t);     /* Allocate an array of numbers. */
 FACT_scope_t FACT_alloc_scope (void);          /* Allocate a scope.             */
+void FACT_recycle_scope (FACT_scope_t);        /* Reset a scope for reuse.      */
 FACT_scope_t *FACT_alloc_scope_array (size_t); /* Allocate an array of scopes.  */
 
 #endif
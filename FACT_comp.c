@@ -21,6 +21,7 @@
 #include "FACT_lexer.h"
 #include "FACT_mpc.h"
 #include "FACT_alloc.h"
+#include "FACT_hash.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -50,7 +51,8 @@ struct inter_node {
 	  REG_VAL,
 	  ADDR_VAL,
 	  INT_VAL,
-	  STR_VAL
+	  STR_VAL,
+	  SYM_VAL
 	} arg_type;
 	union {
 	  size_t addr;
@@ -66,14 +68,11 @@ struct inter_node {
   } node_val;
 };
 
-static char *strlen_dq (char *);
-static char *strlen_sq (char *);
+static char *unescape (char *, bool);
 static struct inter_node *create_node ();
 static struct inter_node *compile_tree (FACT_tree_t, size_t, size_t, bool);
 static struct inter_node *compile_args (FACT_tree_t);
 static struct inter_node *compile_array_dec (FACT_tree_t);
-static struct inter_node *compile_str_dq (char *, size_t);
-static struct inter_node *compile_str_sq (char *, size_t);
 
 static struct inter_node *begin_temp_scope ();
 static struct inter_node *end_temp_scope ();
@@ -85,6 +84,23 @@ static size_t weight (struct inter_node *);
 static inline void spread (char *, size_t);
 
 static inline void push_const (struct inter_node *, char *);
+static inline bool is_up (FACT_tree_t);
+static FACT_pack_t pack_type (char *);
+static bool escapes (FACT_tree_t);
+static bool declares (FACT_tree_t, FACT_tree_t);
+static bool mentions (FACT_tree_t, char *, FACT_tree_t);
+static bool is_temp (FACT_tree_t);
+
+/* Set to the function being compiled when its frame can't escape, so that
+ * its returns are compiled to RET_F and blocks in it can hoist their
+ * declarations. Its arguments are children[1] and its body children[2].
+ */
+static FACT_tree_t frame_local = NULL;
+
+/* Set while compiling a function body outside of any catch region, where a
+ * returned call can replace the function's call frame.
+ */
+static bool tail_ok = false;
 
 void FACT_compile (FACT_tree_t tree, const char *file_name, bool set_rx)
 {
@@ -164,6 +180,14 @@ static inline struct inst_arg str_arg (char *str_val) /* String value. */
   return ret;
 }
 
+static inline struct inst_arg sym_arg (char *name) /* Symbol value, interned here. */
+{
+  struct inst_arg ret;
+  ret.arg_type = SYM_VAL;
+  ret.arg_val.str = FACT_intern (name);
+  return ret;
+}
+
 /* Since I do not know of any compilation techniques, so it's sort of just ad-hoc.
  * TODO: add argument checking for functions.
  * Also, clean this up with some macros/inline functions.
@@ -177,6 +201,10 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
   char *dims_str, *elems_str;
   size_t i, j;
   size_t dims, elems;
+  long slot;
+  bool scoped;
+  FACT_tree_t hold_local;
+  bool hold_tail;
   FACT_tree_t n;
 
   static Furlow_opc_t lookup_table [] = {
@@ -210,11 +238,18 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     res->node_type = INSTRUCTION;
     if (!strcmp (curr->id.lexem, "this"))
       res->node_val.inst.inst_val = THIS;
+    else if (!strcmp (curr->id.lexem, "up"))
+      res->node_val.inst.inst_val = UP;
     else if (!strcmp (curr->id.lexem, "lambda"))
       res->node_val.inst.inst_val = LAMBDA;
-    else {
+    else if ((slot = Furlow_find_gslot (FACT_intern (curr->id.lexem))) != -1) {
+      /* Constant globals and BIFs are bound directly to their slot. */
+      res->node_val.inst.inst_val = GVAR;
+      res->node_val.inst.args[0] = int_arg (slot);
+      res->node_val.inst.args[1] = sym_arg (curr->id.lexem);
+    } else {
       res->node_val.inst.inst_val = VAR;
-      res->node_val.inst.args[0] = str_arg (curr->id.lexem);
+      res->node_val.inst.args[0] = sym_arg (curr->id.lexem);
     }
     break;
 
@@ -231,36 +266,18 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
 
   case E_SQ:
   case E_DQ:
-    res->node_type = GROUPING;
-    res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 6);
-    
-    /* Push the length of the string, as a string. */
-    /*
-    add_instruction (res, CONST, str_arg ((curr->id.id == E_SQ)
-    ? strlen_sq (curr->children[0]->id.lexem)
-    : strlen_dq (curr->children[0]->id.lexem)), ignore (), ignore ());
-    */
-    push_const (res, ((curr->id.id == E_SQ)
-		      ? strlen_sq (curr->children[0]->id.lexem)
-		      : strlen_dq (curr->children[0]->id.lexem)));
-    //    add_instruction (res, CONSTS, str_arg ("1")  , ignore ()    , ignore ()); /* Push one to the stack. */
-    add_instruction (res, CONSTU, int_arg (1), ignore (), ignore ());
-    add_instruction (res, NEW_N, reg_arg (R_POP), ignore ()    , ignore ()); /* Create an anonymous array. */      
-    add_instruction (res, REF  , reg_arg (R_TOP), reg_arg (R_A), ignore ()); /* Set the A register to the array. */
-    //    add_instruction (res, CONST, str_arg ("0")  , ignore ()    , ignore ()); /* Push the string index to the stack (used for setting the string). */
-    add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-    
-    /* Set the array to the string. */
-    set_child (res, ((curr->id.id == E_SQ)
-		     ? compile_str_sq (curr->children[0]->id.lexem, 0)
-		     : compile_str_dq (curr->children[0]->id.lexem, 0)));
+    /* The string is made in one instruction, with its escapes resolved. */
+    res->node_type = INSTRUCTION;
+    res->node_val.inst.inst_val = STR;
+    res->node_val.inst.args[0] = str_arg (unescape (curr->children[0]->id.lexem,
+						    curr->id.id == E_DQ));
     break;
     
   case E_LOCAL_CHECK:
   case E_GLOBAL_CHECK:
     res->node_type = INSTRUCTION;
     res->node_val.inst.inst_val = lookup_table[curr->id.id];
-    res->node_val.inst.args[0] = str_arg (curr->children[0]->id.lexem);
+    res->node_val.inst.args[0] = sym_arg (curr->children[0]->id.lexem);
     break;
     
   case E_NEG:
@@ -349,10 +366,19 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
       
   case E_ARRAY_ELEM:
     res->node_type = GROUPING;
-    res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 3);
-    set_child (res, compile_tree (curr->children[0], 0, 0, set_rx));
-    set_child (res, compile_tree (curr->children[1], 0, 0, set_rx));
-    add_instruction (res, ELEM, reg_arg (R_POP), reg_arg (R_POP), ignore ());
+    /* a[i][j]... is indexed by one elems instruction. The indices are
+     * still evaluated from the last to the first, then the array.
+     */
+    for (i = 0, n = curr; n->id.id == E_ARRAY_ELEM; n = n->children[1])
+      i++;
+    res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * (i + 2));
+    for (n = curr; n->id.id == E_ARRAY_ELEM; n = n->children[1])
+      set_child (res, compile_tree (n->children[0], 0, 0, set_rx));
+    set_child (res, compile_tree (n, 0, 0, set_rx));
+    if (i == 1)
+      add_instruction (res, ELEM, reg_arg (R_POP), reg_arg (R_POP), ignore ());
+    else
+      add_instruction (res, ELEMS, reg_arg (R_POP), int_arg (i), ignore ());
     break;
 
   case E_OP_BRACK: 
@@ -427,10 +453,10 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     add_instruction (res, DUP, ignore (), ignore (), ignore ());
     add_instruction (res, JIS, reg_arg (R_TOP), addr_arg (5), ignore ());
     add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-    add_instruction (res, DEF_N, reg_arg (R_POP), str_arg (curr->children[0]->id.lexem), ignore ());
+    add_instruction (res, DEF_N, reg_arg (R_POP), sym_arg (curr->children[0]->id.lexem), ignore ());
     add_instruction (res, JMP, addr_arg (7), ignore (), ignore ());
     add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-    add_instruction (res, DEF_S, reg_arg (R_POP), str_arg (curr->children[0]->id.lexem), ignore ());    
+    add_instruction (res, DEF_S, reg_arg (R_POP), sym_arg (curr->children[0]->id.lexem), ignore ());    
     add_instruction (res, SWAP, ignore (), ignore (), ignore ());
     add_instruction (res, STO, reg_arg (R_POP), reg_arg (R_POP), ignore ());
     break;
@@ -444,14 +470,9 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     add_instruction (res, LAMBDA, ignore (), ignore (), ignore ()); /* Create a lambda scope. */
     /* Compile the function being called. */
     set_child (res, compile_tree (curr->children[1], 0, 0, set_rx));
-    /* Set the up variable of the lambda scope to it. */
+    /* Set the up link of the lambda scope to it. */
     add_instruction (res, REF  , reg_arg (R_POP), reg_arg (R_A)  , ignore ());
-    add_instruction (res, USE  , reg_arg (R_POP), ignore ()      , ignore ()); /* Briefly enter the scope to do so. */
-    //    add_instruction (res, CONST, str_arg ("0")  , ignore ()      , ignore ());
-    add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-    add_instruction (res, DEF_S, reg_arg (R_POP), str_arg ("up") , ignore ());
-    add_instruction (res, STO  , reg_arg (R_A)  , reg_arg (R_POP), ignore ());
-    add_instruction (res, EXIT , ignore ()      , ignore ()      , ignore ());
+    add_instruction (res, SET_U, reg_arg (R_TOP), reg_arg (R_A)  , ignore ());
     add_instruction (res, SET_F, reg_arg (R_A)  , reg_arg (R_TOP), ignore ()); /* Set the lambda scope's code address and call it. */
     add_instruction (res, NAME , reg_arg (R_A)  , reg_arg (R_TOP), ignore ()); /* Change the lambda scope's name to the function being called. */
     add_instruction (res, CALL , reg_arg (R_POP), ignore ()      , ignore ());
@@ -462,10 +483,16 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 7);
     add_instruction (res, JMP, addr_arg (4), ignore (), ignore ());
     set_child (res, compile_args (curr->children[1]));
+    hold_local = frame_local;
+    hold_tail = tail_ok;
+    frame_local = (escapes (curr->children[2]) ? NULL : curr);
+    tail_ok = true;
     set_child (res, compile_tree (curr->children[2], 1, 0, set_rx));
     //    add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
     add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-    add_instruction (res, RET, ignore (), ignore (), ignore ());
+    add_instruction (res, frame_local ? RET_F : RET, ignore (), ignore (), ignore ());
+    frame_local = hold_local;
+    tail_ok = hold_tail;
     set_child (res, compile_tree (curr->children[0], 0, 0, set_rx));
     add_instruction (res, SET_C, reg_arg (R_TOP), addr_arg (1), ignore ());
     break;
@@ -476,13 +503,19 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     add_instruction (res, JMP, addr_arg (4), ignore (), ignore ());
     /* This is a little messed up because of how quick this was implemented. */
     set_child (res, compile_args (curr->children[0]->children[1]));
+    hold_local = frame_local;
+    hold_tail = tail_ok;
+    frame_local = (escapes (curr->children[0]->children[2]) ? NULL : curr->children[0]);
+    tail_ok = true;
     set_child (res, compile_tree (curr->children[0]->children[2], 1, 0, set_rx));
     // add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
     add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-    add_instruction (res, RET, ignore (), ignore (), ignore ());
+    add_instruction (res, frame_local ? RET_F : RET, ignore (), ignore (), ignore ());
+    frame_local = hold_local;
+    tail_ok = hold_tail;
     // add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
     add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-    add_instruction (res, DEF_S, reg_arg (R_POP), str_arg (curr->children[0]->id.lexem), ignore ());
+    add_instruction (res, DEF_S, reg_arg (R_POP), sym_arg (curr->children[0]->id.lexem), ignore ());
     add_instruction (res, SET_C, reg_arg (R_TOP), addr_arg (1), ignore ());
     break;
     
@@ -490,6 +523,31 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     /* Make sure that s_count != 0, so that we know we are in a scope that can return. */
     assert (s_count != 0); /* Throw a compilation error here. */
     res->node_type = GROUPING;
+
+    if (tail_ok
+	&& curr->children[0] != NULL
+	&& curr->children[0]->id.id == E_FUNC_CALL) {
+      /* Tail call. Set the call up like E_FUNC_CALL, exit the lambda scopes
+       * and then replace this function's frame with it. The RET is only
+       * reached when calling a builtin.
+       */
+      res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * (9 + (s_count - 1) * 2));
+      set_child (res, compile_tree (curr->children[0]->children[0], 0, 0, set_rx));
+      add_instruction (res, LAMBDA, ignore (), ignore (), ignore ());
+      set_child (res, compile_tree (curr->children[0]->children[1], 0, 0, set_rx));
+      add_instruction (res, REF  , reg_arg (R_POP), reg_arg (R_A)  , ignore ());
+      add_instruction (res, SET_U, reg_arg (R_TOP), reg_arg (R_A)  , ignore ());
+      add_instruction (res, SET_F, reg_arg (R_A)  , reg_arg (R_TOP), ignore ());
+      add_instruction (res, NAME , reg_arg (R_A)  , reg_arg (R_TOP), ignore ());
+      for (i = 0; i < s_count - 1; i++) {
+	add_instruction (res, EXIT, ignore (), ignore (), ignore ());
+	add_instruction (res, DROP, ignore (), ignore (), ignore ());
+      }
+      add_instruction (res, frame_local ? TCALL_F : TCALL, reg_arg (R_POP), ignore (), ignore ());
+      add_instruction (res, frame_local ? RET_F : RET, ignore (), ignore (), ignore ());
+      break;
+    }
+
     res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * (5 + (s_count - 1) * 2));
     set_child (res, compile_tree (curr->children[0], 0, 0, set_rx));
     add_instruction (res, DUP, ignore (), ignore (), ignore ());
@@ -501,7 +559,7 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
       add_instruction (res, EXIT, ignore (), ignore (), ignore ());
       add_instruction (res, DROP, ignore (), ignore (), ignore ());
     }
-    add_instruction (res, RET, ignore (), ignore (), ignore ());
+    add_instruction (res, frame_local ? RET_F : RET, ignore (), ignore (), ignore ());
     break;
 
   case E_GIVE:
@@ -516,7 +574,7 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
       add_instruction (res, EXIT, ignore (), ignore (), ignore ());
       add_instruction (res, DROP, ignore (), ignore (), ignore ());
     }
-    add_instruction (res, RET, ignore (), ignore (), ignore ());
+    add_instruction (res, frame_local ? RET_F : RET, ignore (), ignore (), ignore ());
     break;
 
   case E_BREAK:
@@ -537,6 +595,16 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
   case E_SET:
     res->node_type = GROUPING;
     res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 3);
+    if (is_up (curr->children[0])) {
+      /* up is not a real variable, so set the link itself. */
+      set_child (res, compile_tree (curr->children[1], 0, 0, set_rx));
+      if (curr->children[0]->id.id == E_IN)
+	set_child (res, compile_tree (curr->children[0]->children[0], 0, 0, set_rx));
+      else
+	add_instruction (res, THIS, ignore (), ignore (), ignore ());
+      add_instruction (res, SET_U, reg_arg (R_POP), reg_arg (R_TOP), ignore ());
+      break;
+    }
     set_child (res, compile_tree (curr->children[0], 0, 0, set_rx));
     set_child (res, compile_tree (curr->children[1], 0, 0, set_rx));
     add_instruction (res, STO, reg_arg (R_POP), reg_arg (R_TOP), ignore ());
@@ -579,13 +647,22 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
       //      add_instruction (res, CONST, str_arg (dims_str), ignore (), ignore ());
       push_const (res, dims_str);
     }
-    add_instruction (res, curr->id.id == E_NUM_DEF ? DEF_N : DEF_S,
-		     reg_arg (R_POP), str_arg (curr->children[1]->id.lexem), ignore ());
+    if (curr->children[0] != NULL && curr->id.id == E_NUM_DEF
+	&& pack_type (curr->id.lexem) != PACK_NONE)
+      /* The array is declared with an element type. */
+      add_instruction (res, DEF_T, reg_arg (R_POP), int_arg (pack_type (curr->id.lexem)),
+		       sym_arg (curr->children[1]->id.lexem));
+    else
+      add_instruction (res, curr->id.id == E_NUM_DEF ? DEF_N : DEF_S,
+		       reg_arg (R_POP), sym_arg (curr->children[1]->id.lexem), ignore ());
     break;
 
   case E_CONST:
     res->node_type = GROUPING;
 
+    /* Give the constant a global slot, so later references can bind to it. */
+    Furlow_reserve_gslot (FACT_intern (curr->children[0]->id.lexem));
+
     if (curr->children[1] != NULL && curr->children[1]->id.id == E_SET) {
       res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 6);
       //      add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
@@ -597,17 +674,23 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
       res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 10);
       add_instruction (res, JMP, addr_arg (4), ignore (), ignore ());
       set_child (res, compile_args (curr->children[1]));
+      hold_local = frame_local;
+      hold_tail = tail_ok;
+      frame_local = (escapes (curr->children[2]) ? NULL : curr);
+      tail_ok = true;
       set_child (res, compile_tree (curr->children[2], 1, 0, set_rx));
       //      add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
       add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-      add_instruction (res, RET, ignore (), ignore (), ignore ());
+      add_instruction (res, frame_local ? RET_F : RET, ignore (), ignore (), ignore ());
+      frame_local = hold_local;
+      tail_ok = hold_tail;
       //      add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
       add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
       add_instruction (res, NEW_S, reg_arg (R_POP), ignore (), ignore ());
       add_instruction (res, SET_C, reg_arg (R_TOP), addr_arg (1), ignore ());
     }
     add_instruction (res, LOCK, reg_arg (R_TOP), ignore (), ignore ());
-    add_instruction (res, GLOBAL, reg_arg (R_TOP), str_arg (curr->children[0]->id.lexem), ignore ());      
+    add_instruction (res, GLOBAL, reg_arg (R_TOP), sym_arg (curr->children[0]->id.lexem), ignore ());      
     break;
 
   case E_IF:
@@ -631,9 +714,14 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     res->node_type = GROUPING;
     res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 10);
 
+    /* Only give the loop a scope if something in it needs one. */
+    scoped = (s_count == 0
+	      || declares (curr->children[0], curr)
+	      || declares (curr->children[1], curr));
+
     /* Set the break point. */
     add_instruction (res, JMP_PNT, addr_arg (6), ignore (), ignore ());     /* 0 */
-    set_child (res, begin_temp_scope ());                                   /* 1 */
+    set_child (res, scoped ? begin_temp_scope () : NULL);                   /* 1 */
     set_child (res, compile_tree (curr->children[0], 0, 0, set_rx));        /* 2 */
 
     if (curr->children[0] == NULL)
@@ -647,29 +735,35 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
       set_child (res, NULL);                                                /* 5 */
     } else if (curr->children[1]->id.id == E_OP_CURL) {
       set_child (res, compile_tree (curr->children[1]->children[0],         /* 4 */
-				    s_count + 1, s_count + 1, set_rx)); 
+				    s_count + scoped, s_count + scoped, set_rx)); 
       set_child (res, NULL);                                                /* 5 */
       
     } else {
       set_child (res, compile_tree (curr->children[1],                      /* 4 */
-				    s_count + 1, s_count + 1, set_rx));
+				    s_count + scoped, s_count + scoped, set_rx));
       /* Drop the return value of every statement. */
       add_instruction (res, DROP, ignore (), ignore (), ignore ());         /* 5 */
     }
 
     add_instruction (res, JMP, addr_arg (2), ignore (), ignore ());         /* 6 */
     add_instruction (res, DROP, ignore (), ignore (), ignore ());           /* 7 */
-    set_child (res, end_temp_scope ());                                     /* 8 */
-    set_child (res, set_return_val ());                                     /* 9 */
+    set_child (res, scoped ? end_temp_scope () : NULL);                     /* 8 */
+    set_child (res, scoped ? set_return_val () : NULL);                     /* 9 */
     break;
       
   case E_FOR:
     res->node_type = GROUPING;
     res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 12);
 
+    scoped = (s_count == 0
+	      || declares (curr->children[0], curr)
+	      || declares (curr->children[1], curr)
+	      || declares (curr->children[2], curr)
+	      || declares (curr->children[3], curr));
+
     /* Set the break point. */
     add_instruction (res, JMP_PNT, addr_arg (8), ignore (), ignore ());
-    set_child (res, begin_temp_scope ());
+    set_child (res, scoped ? begin_temp_scope () : NULL);
     set_child (res, compile_tree (curr->children[0], 0, 0, set_rx));
     set_child (res, compile_tree (curr->children[1], 0, 0, set_rx));
 
@@ -682,10 +776,10 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
       set_child (res, NULL);
     /* Do not create a new scope for brackets. */
     else if (curr->children[3]->id.id == E_OP_CURL)
-      set_child (res, compile_tree (curr->children[3]->children[0], s_count + 1, s_count + 1, set_rx));
+      set_child (res, compile_tree (curr->children[3]->children[0], s_count + scoped, s_count + scoped, set_rx));
 				      
     else
-      set_child (res, compile_tree (curr->children[3], s_count + 1, s_count + 1, set_rx));
+      set_child (res, compile_tree (curr->children[3], s_count + scoped, s_count + scoped, set_rx));
 
     set_child (res, compile_tree (curr->children[2], 0, 0, set_rx));
 
@@ -697,15 +791,19 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     
     add_instruction (res, JMP, addr_arg (3), ignore (), ignore ());
     add_instruction (res, DROP, ignore (), ignore (), ignore ());
-    set_child (res, end_temp_scope ());
-    set_child (res, set_return_val ());
+    set_child (res, scoped ? end_temp_scope () : NULL);
+    set_child (res, scoped ? set_return_val () : NULL);
     break;
 
   case E_CATCH:
     res->node_type = GROUPING;
     res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 6);
     add_instruction (res, TRAP_B, addr_arg (3), ignore (), ignore ());
+    /* The trap belongs to this frame, so nothing in it can be a tail call. */
+    hold_tail = tail_ok;
+    tail_ok = false;
     set_child (res, compile_tree (curr->children[0], s_count, l_count, set_rx));
+    tail_ok = hold_tail;
     add_instruction (res, TRAP_E, ignore (), ignore (), ignore ());
     add_instruction (res, JMP, addr_arg (5), ignore (), ignore ());
     add_instruction (res, TRAP_E, ignore (), ignore (), ignore ());
@@ -720,7 +818,20 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
     add_instruction (res, DIE, ignore (), ignore (), ignore ());
     break;
 
-  case E_OP_CURL: /* This REALLY needs to be optimized. */
+  case E_OP_CURL:
+    /* A block statement that declares nothing is compiled in place. Since
+     * it leaves no scope on the stack, the closing bracket is skipped too.
+     */
+    if (s_count != 0
+	&& curr->next != NULL
+	&& curr->next->id.id == E_CL_CURL
+	&& !declares (curr->children[0], curr)) {
+      res->node_type = GROUPING;
+      res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *));
+      set_child (res, compile_tree (curr->children[0], s_count, l_count, set_rx));
+      res->next = compile_tree (curr->next->next, s_count, l_count, set_rx);
+      return res;
+    }
     res->node_type = GROUPING;
     res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 3);
     set_child (res, begin_temp_scope ());
@@ -755,216 +866,52 @@ static struct inter_node *compile_tree (FACT_tree_t curr,
   return res;
 }
 
-static char *strlen_dq (char *str) /* Get the length of a string and return it as a string of digits in base 10. */
-{
-  size_t i, j;
-  size_t res_len;
-  char hold;
-  char *res;
-
-  res = FACT_malloc (2);
-  res_len = 2;
-  res[0] = '0';
-  res[1] = '\0';
-
-  for (i = 0; str[i] != '\0'; i++) {
-    /* Adjust for escape sequences. */
-    if (str[i] == '\\'
-	&& (str[i + 1] == '"'
-	    || str[i + 1] == 'r'
-	    || str[i + 1] == 'n'
-	    || str[i + 1] == 't'
-	    || str[i + 1] == '\\'))
-      i++;
-    
-    /* Carry the one over. */ 
-    for (j = 0; j < res_len - 1; j++) {
-      if (res[j] != '9') {
-	res[j]++;
-	break;
-      } else
-	res[j] = '0'; /* Continue to carry over. */
-    }
-    if (j == res_len - 1) {
-      /* A new digit is needed. */
-      res = FACT_realloc (res, ++res_len);
-      res[j] = '1';
-      res[j + 1] = '\0';
-    }
-  }
-  
-  /* Reverse the string. */
-  for (i = 0, j = res_len - 2; i < j; i++, j--) {
-    hold = res[j];
-    res[j] = res[i];
-    res[i] = hold;
-  }
-  
-  return res;
-}
-
-static char *strlen_sq (char *str) /* Get the length of a string and return it as a string of digits in base 10.
-				    * I know, that's pretty stupid.
-				    */
+static char *unescape (char *str, bool dq) /* Resolve the escape sequences of a string literal. */
 {
   size_t i, j;
-  size_t res_len;
-  char hold;
   char *res;
 
-  res = FACT_malloc (2);
-  res_len = 2;
-  res[0] = '0';
-  res[1] = '\0';
+  res = FACT_malloc_atomic (strlen (str) + 1);
 
-  for (i = 0; str[i] != '\0'; i++) {
-    /* Adjust for escape sequences. */
-    if (str[i] == '\\'
-	&& (str[i + 1] == '\'' || str[i + 1] == '\\'))
-      i++;
-    
-    /* Carry the one over. */ 
-    for (j = 0; j < res_len - 1; j++) {
-      if (res[j] != '9') {
-	res[j]++;
-	break;
-      } else
-	res[j] = '0'; /* Continue to carry over. */
-    }
-    if (j == res_len - 1) {
-      /* A new digit is needed. */
-      res = FACT_realloc (res, ++res_len);
-      res[j] = '1';
-      res[j + 1] = '\0';
+  for (i = j = 0; str[i] != '\0'; i++, j++) {
+    if (str[i] != '\\') {
+      res[j] = str[i];
+      continue;
     }
-  }
-  
-  /* Reverse the string. */
-  for (i = 0, j = res_len - 2; i < j; i++, j--) {
-    hold = res[j];
-    res[j] = res[i];
-    res[i] = hold;
-  }
-  
-  return res;
-}
 
-static struct inter_node *compile_str_dq (char *str, size_t i) /* Compile a double-quotation string. */
-{
-  char new;
-  char *c_val;
-  struct inter_node *res;
-
-  if (str[i] == '\0') {
-    /* End of the string. Drop the index. */
-    res = create_node ();
-    res->node_type = INSTRUCTION;
-    res->node_val.inst.inst_val = DROP;
-    return res;
-  }
-  
-  if (str[i] == '\\') { /* Fix escape sequences. */
-    ++i;
-    switch (str[i]) {
-    case '\0':
-    default:
-      --i;
-      /* Fall through. */
+    /* Unknown escape sequences are left as they are. */
+    switch (str[i + 1]) {
     case '\\':
-      new = '\\';
+      res[j] = '\\';
       break;
-      
+
     case '"':
-      new = '"';
+    case '\'':
+      if (str[i + 1] != (dq ? '"' : '\''))
+	goto unknown;
+      res[j] = str[i + 1];
       break;
-      
+
     case 'n': /* Newline. */
-      new = '\n';
-      break;
-      
     case 'r': /* Carraige return. */
-      new = '\r';
-      break;
-      
     case 't': /* Tab. */
-      new = '\t';
+      if (!dq)
+	goto unknown;
+      res[j] = ((str[i + 1] == 'n')
+		? '\n'
+		: ((str[i + 1] == 'r')
+		   ? '\r'
+		   : '\t'));
       break;
-    }
-  } else
-    new = str[i];
-
-  /* Convert the character value to a string. */
-  c_val = FACT_malloc (4);
-  c_val[0] = (new / 100 % 10) + '0';
-  c_val[1] = (new / 10 % 10) + '0';
-  c_val[2] = (new % 10) + '0';
-  c_val[3] = '\0';
-  
-  res = create_node ();
-  res->node_type = GROUPING;
-  res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 6);
-  add_instruction (res, DUP, ignore (), ignore (), ignore ());
-  add_instruction (res, ELEM, reg_arg (R_A), reg_arg (R_POP), ignore ());
-  //  add_instruction (res, CONST, str_arg (c_val), ignore (), ignore ());
-  push_const (res, c_val);
-  add_instruction (res, STO, reg_arg (R_POP), reg_arg (R_POP), ignore ());
-  add_instruction (res, INC, reg_arg (R_TOP), ignore (), ignore ());
-  /* Increase the index one and compile the next character. */
-  set_child (res, compile_str_dq (str, i + 1));
 
-  return res;
-}
-
-static struct inter_node *compile_str_sq (char *str, size_t i) /* Compile a single-quotation string. */
-{
-  char new;
-  char *c_val;
-  struct inter_node *res;
-
-  if (str[i] == '\0') {
-    /* End of the string. Drop the index. */
-    res = create_node ();
-    res->node_type = INSTRUCTION;
-    res->node_val.inst.inst_val = DROP;
-    return res;
-  }
-  
-  if (str[i] == '\\') { /* Fix escape sequences. */
-    ++i;
-    switch (str[i]) {
-    case '\0':
     default:
-      --i;
-      /* Fall through. */
-    case '\\':
-      new = '\\';
-      break;
-      
-    case '\'':
-      new = '\'';
-      break;
+    unknown:
+      res[j] = '\\';
+      continue;
     }
-  } else
-    new = str[i];
-
-  /* Convert the character value to a string. This is kind of dumb. */
-  c_val = FACT_malloc (4);
-  c_val[0] = (new / 100 % 10) + '0';
-  c_val[1] = (new / 10 % 10) + '0';
-  c_val[2] = (new % 10) + '0';
-  c_val[3] = '\0';
-  
-  res = create_node ();
-  res->node_type = GROUPING;
-  res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 6);
-  add_instruction (res, DUP, ignore (), ignore (), ignore ());
-  add_instruction (res, ELEM, reg_arg (R_A), reg_arg (R_POP), ignore ());
-  //  add_instruction (res, CONST, str_arg (c_val), ignore (), ignore ());
-  push_const (res, c_val);
-  add_instruction (res, STO, reg_arg (R_POP), reg_arg (R_POP), ignore ());
-  add_instruction (res, INC, reg_arg (R_TOP), ignore (), ignore ());
-  /* Increase the index one and compile the next character. */
-  set_child (res, compile_str_sq (str, i + 1));
+    i++;
+  }
+  res[j] = '\0';
 
   return res;
 }
@@ -980,7 +927,8 @@ static struct inter_node *compile_array_dec (FACT_tree_t curr)
   res->node_type = GROUPING;
   res->node_val.grouping.children = FACT_malloc (sizeof (struct inter_node *) * 3);
   set_child (res, compile_tree (curr->children[0], 0, 0, false));
-  add_instruction (res, APPEND, reg_arg (R_POP), reg_arg (R_TOP), ignore ());
+  add_instruction (res, (is_temp (curr->children[0]) ? MOVE : APPEND),
+		   reg_arg (R_POP), reg_arg (R_TOP), ignore ());
   set_child (res, compile_array_dec (curr->children[1]));
 
   return res;
@@ -998,11 +946,8 @@ static struct inter_node *begin_temp_scope (void) /* Create a temporary scope wi
   add_instruction (res, THIS, ignore (), ignore (), ignore ());
   add_instruction (res, REF, reg_arg (R_POP), reg_arg (R_A), ignore ());
   add_instruction (res, LAMBDA, ignore (), ignore (), ignore ()); /* Create an anonymous scope. */
+  add_instruction (res, SET_U, reg_arg (R_TOP), reg_arg (R_A), ignore ()); /* Link it to the current scope. */
   add_instruction (res, USE, reg_arg (R_POP), ignore (), ignore ()); /* Push the scope to the call stack. */
-  //  add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ()); /* Create an "up" variable for the scope. */
-  add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-  add_instruction (res, DEF_S, reg_arg (R_POP), str_arg ("up"), ignore ());
-  add_instruction (res, STO, reg_arg (R_A), reg_arg (R_POP), ignore ());
 
   return res;
 }
@@ -1060,7 +1005,7 @@ static struct inter_node *compile_args (FACT_tree_t curr)
     //    add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
     add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
     add_instruction (res, curr->id.id == E_NUM_DEF ? DEF_N : DEF_S,
-		     reg_arg (R_POP), str_arg (curr->children[0]->id.lexem), ignore ());
+		     reg_arg (R_POP), sym_arg (curr->children[0]->id.lexem), ignore ());
   } else { /* Dynamically typed argument. */
     /* jis,%top,
      * const,$0
@@ -1072,11 +1017,11 @@ static struct inter_node *compile_args (FACT_tree_t curr)
     add_instruction (res, JIS, reg_arg (R_TOP), addr_arg (3), ignore ());
     //    add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
     add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
-    add_instruction (res, DEF_N, reg_arg (R_POP), str_arg (curr->children[0]->id.lexem), ignore ());
+    add_instruction (res, DEF_N, reg_arg (R_POP), sym_arg (curr->children[0]->id.lexem), ignore ());
     add_instruction (res, JMP, addr_arg (5), ignore (), ignore ());
     add_instruction (res, CONSTU, int_arg (0), ignore (), ignore ());
     //    add_instruction (res, CONST, str_arg ("0"), ignore (), ignore ());
-    add_instruction (res, DEF_S, reg_arg (R_POP), str_arg (curr->children[0]->id.lexem), ignore ());
+    add_instruction (res, DEF_S, reg_arg (R_POP), sym_arg (curr->children[0]->id.lexem), ignore ());
   }
   
   add_instruction (res, SWAP, ignore (), ignore (), ignore ());
@@ -1143,6 +1088,11 @@ static void load (struct inter_node *curr, struct inter_node *up, const char *fi
       case STR_VAL:
 	fmt = FACT_realloc (fmt, len + strlen (curr->node_val.inst.args[i].arg_val.str) + 1);
 	strcpy (fmt + len, curr->node_val.inst.args[i].arg_val.str);
+	goto load_fmt;
+
+      case SYM_VAL:
+	fmt = FACT_realloc (fmt, len + sizeof (char *));
+	memcpy (fmt + len, &curr->node_val.inst.args[i].arg_val.str, sizeof (char *));
 	/* Fall through. */
 	
       default:
@@ -1213,3 +1163,150 @@ static inline void push_const (struct inter_node *r, char *str)
     mpz_clear (temp);
   }
 }
+
+static FACT_pack_t pack_type (char *keyword) /* Get the element type declared by a num keyword. */
+{
+  if (!strcmp (keyword, "i64"))
+    return PACK_I64;
+  if (!strcmp (keyword, "f64"))
+    return PACK_F64;
+  if (!strcmp (keyword, "u8"))
+    return PACK_U8;
+  return PACK_NONE;
+}
+
+static inline bool is_up (FACT_tree_t curr) /* Check if an lvalue is up or x:up. */
+{
+  if (curr->id.id == E_IN)
+    curr = curr->children[1];
+  return (curr->id.id == E_VAR && !strcmp (curr->id.lexem, "up"));
+}
+
+static bool mentions (FACT_tree_t curr, char *name, FACT_tree_t skip) /* Check if a name appears in a tree, outside of skip. */
+{
+  size_t i;
+
+  for (; curr != NULL; curr = curr->next) {
+    if (curr == skip)
+      continue;
+    if (curr->id.lexem != NULL && !strcmp (curr->id.lexem, name))
+      return true;
+    for (i = 0; i < 4; i++) {
+      if (mentions (curr->children[i], name, skip))
+	return true;
+    }
+  }
+
+  return false;
+}
+
+static bool declares (FACT_tree_t curr, FACT_tree_t block) /* Check if a block needs a scope of its own. */
+{
+  size_t i;
+
+  /* Anything that defines a variable or can see the this scope needs it.
+   * The exception is a number declared in a function with a local frame,
+   * when its name is used nowhere else in the function. Then it can be
+   * hoisted up into the frame, as nothing outside the block can tell.
+   */
+  for (; curr != NULL; curr = curr->next) {
+    switch (curr->id.id) {
+    case E_VAR:
+      if (!strcmp (curr->id.lexem, "this")
+	  || !strcmp (curr->id.lexem, "up")
+	  || !strcmp (curr->id.lexem, "lambda"))
+	return true;
+      break;
+
+    case E_NUM_DEF:
+      if (frame_local == NULL
+	  || mentions (frame_local->children[1], curr->children[1]->id.lexem, NULL)
+	  || mentions (frame_local->children[2], curr->children[1]->id.lexem, block))
+	return true;
+      break;
+
+    case E_LOCAL_CHECK:
+    case E_THREAD:
+    case E_FUNC_DEF:
+    case E_DEFUNC:
+    case E_CONST:
+    case E_SCOPE_DEF:
+    case E_IMP_DEF:
+      return true;
+
+    default:
+      break;
+    }
+
+    for (i = 0; i < 4; i++) {
+      if (declares (curr->children[i], block))
+	return true;
+    }
+  }
+
+  return false;
+}
+
+static bool escapes (FACT_tree_t curr) /* Check if a function body could leak its frame. */
+{
+  size_t i;
+
+  /* A frame escapes if anything can get a reference to it, or define
+   * something that links up to it. This is conservative: for instance
+   * strings are made of E_VAR nodes, and "this" in a string counts.
+   */
+  for (; curr != NULL; curr = curr->next) {
+    switch (curr->id.id) {
+    case E_VAR:
+      if (!strcmp (curr->id.lexem, "this") || !strcmp (curr->id.lexem, "up"))
+	return true;
+      break;
+
+    case E_THREAD:
+    case E_FUNC_DEF:
+    case E_DEFUNC:
+    case E_CONST:
+    case E_SCOPE_DEF:
+    case E_IMP_DEF:
+      return true;
+
+    default:
+      break;
+    }
+
+    for (i = 0; i < 4; i++) {
+      if (escapes (curr->children[i]))
+	return true;
+    }
+  }
+
+  return false;
+}
+
+static bool is_temp (FACT_tree_t curr) /* Check if an expression always evaluates to a new variable. */
+{
+  switch (curr->id.id) {
+  case E_NUM:
+  case E_SQ:
+  case E_DQ:
+  case E_ADD:
+  case E_SUB:
+  case E_MUL:
+  case E_DIV:
+  case E_MOD:
+  case E_EQ:
+  case E_NE:
+  case E_MT:
+  case E_ME:
+  case E_LT:
+  case E_LE:
+  case E_AND:
+  case E_OR:
+  case E_OP_BRACK:
+    return true;
+
+  default:
+    /* Variables, elements and function calls may all give references. */
+    return false;
+  }
+}
@@ -30,7 +30,7 @@ Furlow_print_state () /* Print out debug information. */
 	  " * Thread # = %zu\n"
 	  " * call stack size = %zu\n"
 	  " * call stack contents:\n",
-	  CURR_IP, curr_thread - threads, curr_thread->cstack_size);
+	  CURR_IP, curr_thread->thread_num, curr_thread->cstack_size);
 
   for (i = 0; i < curr_thread->cstack_size; i++)
     printf ("   * (%zu): Name = %s, ip = %zu\n", i, curr_thread->cstack[i].this->name, curr_thread->cstack[i].ip);
@@ -0,0 +1,218 @@
+/* This file is part of FACT.
+ *
+ * FACT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FACT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FACT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FACT.h"
+#include "FACT_types.h"
+#include "FACT_alloc.h"
+#include "FACT_num.h"
+#include "FACT_dict.h"
+
+#include <string.h>
+#include <stdint.h>
+
+/* Dictionaries are open addressed with linear probing, and deletions
+ * shift the entries after them back rather than leaving tombstones.
+ * Integer keys that fit in 64 bits are kept in the entry itself and
+ * compared without touching GMP. Other keys are copies, so changing the
+ * variable a key came from doesn't move the entry.
+ */
+struct dict_entry {
+  size_t hash;    /* FACT_hash_num of the key, 0 if the entry is unused. */
+  FACT_num_t key; /* Copy of the key, NULL if it is an integer in fix.   */
+  int64_t fix;
+  FACT_t val;
+};
+
+struct FACT_dict {
+  struct dict_entry *entries;
+  size_t mask;        /* Number of entries less one, a power of two less one. */
+  size_t num_entries; /* Entries in use.                                       */
+};
+
+#define INIT_DICT_SIZE 8
+
+static struct dict_entry *find (FACT_dict_t, FACT_num_t, size_t);
+static bool get_fix (FACT_num_t, int64_t *);
+static void grow (FACT_dict_t);
+
+FACT_dict_t FACT_new_dict (void) /* Make an empty dictionary. */
+{
+  FACT_dict_t res;
+
+  res = FACT_malloc (sizeof (struct FACT_dict));
+  res->entries = FACT_malloc (sizeof (struct dict_entry) * INIT_DICT_SIZE);
+  res->mask = INIT_DICT_SIZE - 1;
+  return res;
+}
+
+FACT_t *FACT_dict_get (FACT_dict_t dict, FACT_num_t key) /* Find the value of a key. */
+{
+  struct dict_entry *e;
+
+  e = find (dict, key, FACT_hash_num (key));
+  return (e->hash != 0) ? &e->val : NULL;
+}
+
+void FACT_dict_put (FACT_dict_t dict, FACT_num_t key, FACT_t val) /* Set the value of a key, adding it if it's missing. */
+{
+  size_t hash;
+  FACT_num_t copy;
+  struct dict_entry *e;
+
+  hash = FACT_hash_num (key);
+  e = find (dict, key, hash);
+
+  if (e->hash == 0) {
+    /* Keep the table at most three quarters full. */
+    if ((dict->num_entries + 1) * 4 > (dict->mask + 1) * 3) {
+      grow (dict);
+      e = find (dict, key, hash);
+    }
+    e->hash = hash;
+    if (!get_fix (key, &e->fix)) {
+      e->key = FACT_alloc_num ();
+      FACT_set_num (e->key, key);
+    }
+    dict->num_entries++;
+  } else if (val.type == NUM_TYPE && e->val.type == NUM_TYPE) {
+    /* Update the number in place, as it may be referenced. */
+    FACT_set_num (e->val.ap, val.ap);
+    return;
+  }
+
+  /* Numbers are copied in like any assignment, scopes are referenced. */
+  if (val.type == NUM_TYPE) {
+    copy = FACT_alloc_num ();
+    FACT_set_num (copy, val.ap);
+    val.ap = copy;
+  }
+  val.home = NULL; /* The entry is not the variable's slot. */
+  e->val = val;
+}
+
+bool FACT_dict_del (FACT_dict_t dict, FACT_num_t key) /* Remove a key. */
+{
+  size_t i, j, home;
+  struct dict_entry *e;
+
+  e = find (dict, key, FACT_hash_num (key));
+  if (e->hash == 0)
+    return false;
+
+  /* Move back every entry after the removed one that would otherwise be
+   * cut off from its home slot by the hole.
+   */
+  for (i = e - dict->entries, j = i;;) {
+    j = (j + 1) & dict->mask;
+    if (dict->entries[j].hash == 0)
+      break;
+    home = dict->entries[j].hash & dict->mask;
+    if (((j - home) & dict->mask) >= ((j - i) & dict->mask)) {
+      dict->entries[i] = dict->entries[j];
+      i = j;
+    }
+  }
+
+  memset (dict->entries + i, 0, sizeof (struct dict_entry));
+  dict->num_entries--;
+  return true;
+}
+
+size_t FACT_dict_size (FACT_dict_t dict) /* Number of keys in a dictionary. */
+{
+  return dict->num_entries;
+}
+
+FACT_num_t FACT_dict_keys (FACT_dict_t dict) /* Make an array of all the keys in a dictionary. */
+{
+  size_t i, j;
+  FACT_num_t res;
+
+  res = FACT_alloc_num ();
+  if (dict->num_entries == 0)
+    return res;
+
+  res->array_size = dict->num_entries;
+  res->array_up = FACT_alloc_num_array (dict->num_entries);
+  for (i = j = 0; i <= dict->mask; i++) {
+    if (dict->entries[i].hash == 0)
+      continue;
+    if (dict->entries[i].key == NULL)
+      mpc_set_si (res->array_up[j]->value, dict->entries[i].fix);
+    else
+      FACT_set_num (res->array_up[j], dict->entries[i].key);
+    j++;
+  }
+
+  return res;
+}
+
+static struct dict_entry *find (FACT_dict_t dict, FACT_num_t key, size_t hash) /* Find a key's entry, or the unused entry it would go in. */
+{
+  size_t i;
+  int64_t fix;
+  bool is_fix;
+  struct dict_entry *e;
+
+  is_fix = get_fix (key, &fix);
+  for (i = hash & dict->mask;; i = (i + 1) & dict->mask) {
+    e = dict->entries + i;
+    if (e->hash == 0)
+      return e;
+    if (e->hash != hash)
+      continue;
+
+    if (e->key == NULL) {
+      if (is_fix
+	  ? e->fix == fix
+	  : (key->array_size == 0 && mpc_cmp_si (key->value, e->fix) == 0))
+	return e;
+    } else if (is_fix
+	       ? (e->key->array_size == 0 && mpc_cmp_si (e->key->value, fix) == 0)
+	       : FACT_equal_num (e->key, key))
+      return e;
+  }
+}
+
+static bool get_fix (FACT_num_t key, int64_t *fix) /* Check if a key is an integer that fits in an entry. */
+{
+  if (key->array_size != 0 || key->value->fp || !mpz_fits_slong_p (key->value->intv))
+    return false;
+  *fix = mpz_get_si (key->value->intv);
+  return true;
+}
+
+static void grow (FACT_dict_t dict) /* Double the number of entries. */
+{
+  size_t i, j, old_mask;
+  struct dict_entry *old;
+
+  old = dict->entries;
+  old_mask = dict->mask;
+  dict->mask = old_mask * 2 + 1;
+  dict->entries = FACT_malloc (sizeof (struct dict_entry) * (dict->mask + 1));
+
+  /* Keys are all different, so they only need a free entry. */
+  for (i = 0; i <= old_mask; i++) {
+    if (old[i].hash == 0)
+      continue;
+    for (j = old[i].hash & dict->mask; dict->entries[j].hash != 0; j = (j + 1) & dict->mask)
+      ;
+    dict->entries[j] = old[i];
+  }
+
+  FACT_free (old);
+}
@@ -0,0 +1,34 @@
+/* This file is part of FACT.
+ *
+ * FACT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FACT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FACT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FACT_DICT_H_
+#define FACT_DICT_H_
+
+#include "FACT_types.h"
+
+/* Dictionaries map numbers and arrays (strings, mostly) to numbers or
+ * scopes. A dictionary is a scope with its dict field set.
+ */
+typedef struct FACT_dict *FACT_dict_t;
+
+FACT_dict_t FACT_new_dict (void);
+FACT_t *FACT_dict_get (FACT_dict_t, FACT_num_t);     /* NULL if the key is missing. */
+void FACT_dict_put (FACT_dict_t, FACT_num_t, FACT_t);
+bool FACT_dict_del (FACT_dict_t, FACT_num_t);        /* False if the key is missing. */
+size_t FACT_dict_size (FACT_dict_t);
+FACT_num_t FACT_dict_keys (FACT_dict_t);             /* Array of every key. */
+
+#endif /* FACT_DICT_H_ */
@@ -104,7 +104,7 @@ void FACT_throw_error (FACT_scope_t scope, const char *fmt, ...)
   err.what = buff;
 
   curr_thread->curr_err = err; /* Set the error. */
-  longjmp (handle_err, 1); /* Jump back. */
+  longjmp (curr_thread->handle_err, 1); /* Jump back. */
 }
 
 void FACT_print_error (FACT_error_t err) /* Print out an error to stderr. */
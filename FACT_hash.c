@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "FACT.h"
 #include "FACT_hash.h"
@@ -26,110 +27,222 @@
 
 FACT_t *FACT_find_in_table_nohash (FACT_table_t *table, char *key)
 {
+  return FACT_find_in_table (table, key, FACT_get_hash (key, strlen (key)));
+}
+
+FACT_t *FACT_find_in_table (FACT_table_t *table, char *key, size_t hash)
+{
+  long i;
+  size_t mask;
   register struct _entry *p;
 
-  if (table->num_buckets == 0)
-    return NULL;
+  if (table->buckets == NULL) {
+    /* Shape mode, the lookup is just a search of the shape. */
+    if (table->shape == NULL
+	|| (i = FACT_shape_slot (table->shape, key, hash)) == -1)
+      return NULL;
+    return table->slots + i;
+  }
 
-  for (p = *(table->buckets + FACT_get_hash (key, strlen (key)) % table->num_buckets);
-       p != NULL && p->data->type != UNSET_TYPE;
-       p = p->next) {
-    if (!strcmp (key, FACT_var_name (*p->data)))
+  /* Probe until the key or an unused entry is found. The table is never
+   * full, so this always stops.
+   */
+  mask = table->num_buckets - 1;
+  for (p = table->buckets + (hash & mask);
+       p->name != NULL;
+       p = table->buckets + ((p - table->buckets + 1) & mask)) {
+    if (p->hash == hash && (p->name == key || !strcmp (key, p->name)))
       return p->data;
   }
 
+  /* Item wasn't found. */
   return NULL;
 }
 
-FACT_t *FACT_find_in_table (FACT_table_t *table, char *key, size_t hash)
+/* Root of the shape tree, the shape of a table with one name in it is a
+ * transition from here.
+ */
+static struct FACT_shape root_shape;
+static pthread_mutex_t shape_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct FACT_shape *shape_transition (struct FACT_shape *from, char *name, size_t hash)
 {
-  register struct _entry *p, **fp;
+  size_t i;
+  struct FACT_shape *res;
 
-  /* TODO: add moving the found element to the front of the list. */
-  if (table->num_buckets == 0 ||
-      *(fp = table->buckets + hash % table->num_buckets) == NULL)
-    return NULL;
+  pthread_mutex_lock (&shape_lock);
 
-  for (p = *fp;
-       p->data->type != UNSET_TYPE;
-       p = p->next) {
-    if (!strcmp (key, FACT_var_name (*p->data))) 
-      return p->data;
+  /* See if some other table already took this transition. */
+  for (i = 0; i < from->num_trans; i++) {
+    res = from->trans[i];
+    if (res->hashes[from->size] == hash && !strcmp (res->names[from->size], name))
+      goto done;
   }
 
-  /* Item wasn't found. */
-  return NULL;
+  /* Create a new shape. */
+  res = FACT_malloc (sizeof (struct FACT_shape));
+  res->size = from->size + 1;
+  res->names = FACT_malloc (sizeof (char *) * res->size);
+  res->hashes = FACT_malloc_atomic (sizeof (size_t) * res->size);
+  memcpy (res->names, from->names, sizeof (char *) * from->size);
+  memcpy (res->hashes, from->hashes, sizeof (size_t) * from->size);
+  res->names[from->size] = name;
+  res->hashes[from->size] = hash;
+  res->bloom = from->bloom | FACT_bloom_bit (hash);
+  res->parent = from;
+  res->trans = NULL;
+  res->num_trans = 0;
+
+  from->trans = FACT_realloc (from->trans, sizeof (struct FACT_shape *) * (from->num_trans + 1));
+  from->trans[from->num_trans++] = res;
+
+ done:
+  pthread_mutex_unlock (&shape_lock);
+  return res;
 }
 
-/*
- * I changed my coding style drastically between the last commit. Sorry but not
- * sorry.
- */
-FACT_t *
-FACT_add_to_table(FACT_table_t *table, FACT_t key)
+static FACT_t *add_to_dict (FACT_table_t *, char *, size_t, FACT_t);
+
+FACT_t *FACT_add_to_table (FACT_table_t *table, FACT_t key)
+{
+  char *vname;
+  size_t i, h;
+  FACT_t *res;
+  FACT_t *old_slots;
+  struct FACT_shape *old_shape;
+
+  vname = FACT_var_name (key);
+  h = FACT_sym_hash (vname);
+  key.home = table;
+
+  if (table->buckets == NULL) {
+    if (table->shape == NULL)
+      table->shape = &root_shape;
+
+    if (table->shape->size < MAX_SHAPE_SLOTS) {
+      /* Stay in shape mode, and take the transition for the new name. */
+      if (table->shape->size == table->num_slots) {
+	table->num_slots = (table->num_slots == 0) ? 4 : table->num_slots * 2;
+	table->slots = FACT_realloc (table->slots, sizeof (FACT_t) * table->num_slots);
+      }
+      table->shape = shape_transition (table->shape, vname, h);
+      res = table->slots + table->shape->size - 1;
+      *res = key;
+      table->num_entries = table->shape->size;
+      table->version++;
+      table->bloom |= FACT_bloom_bit (h);
+      return res;
+    }
+
+    /* The table has gotten too big, convert it to a dictionary. */
+    old_shape = table->shape;
+    old_slots = table->slots;
+    table->shape = NULL;
+    table->slots = NULL;
+    table->num_slots = 0;
+    for (i = 0; i < old_shape->size; i++)
+      add_to_dict (table, old_shape->names[i], old_shape->hashes[i], old_slots[i]);
+  }
+
+  res = add_to_dict (table, vname, h, key);
+  table->version++;
+  table->bloom |= FACT_bloom_bit (h);
+  return res;
+}
+
+static FACT_t *add_to_dict (FACT_table_t *table, char *name, size_t hash, FACT_t key)
 {
-	char *vname;
-	size_t i, d, h;
-	struct _entry *p, **pp;
-
-	if (table->buckets == NULL) {
-		table->buckets = FACT_malloc(sizeof (struct _entry *)
-					     * INIT_NUM_BUCKETS);
-		table->num_buckets = INIT_NUM_BUCKETS;
-		table->num_entries = 1;
-		bzero(table->buckets, (sizeof (struct _entry *)
-				       * INIT_NUM_BUCKETS));
-	} else if (++table->num_entries % table->num_buckets == 0 &&
-		   table->num_buckets / table->num_entries == 2) {
-		/*
-		 * If the load factor is two, then we double the number of
-		 * buckets and rehash. Yeah, I probably should read what Knuth
-		 * has to say about this at some point.
-		 */
-		size_t nsize;
-
-		nsize = table->num_buckets << 1;
-		table->buckets = FACT_realloc(table->buckets,
-					      (sizeof (struct _entry *)
-					       * nsize));
-		bzero(table->buckets + table->num_buckets, nsize);
-		for (i = 0; i < table->num_buckets; i++) {
-			pp = (table->buckets + 1);
-			for (p = *(table->buckets + i); p != NULL; ) {
-				vname = FACT_var_name(*p->data);
-				d = FACT_get_hash(vname, strlen(vname));
-				if (d != i) {
-					/*
-					 * Move the entry as ist no longer
-					 * belongs in the current bucket.
-					 */
-					*pp = p->next;
-					p->next = table->buckets[d];
-					p = *pp;
-					continue;
-				}
-				pp = &p->next;
-				p = p->next;
-			}
-		}
-		table->num_buckets = nsize;
-	}
-
-	/* Now finally we add the entry. */
-	vname = FACT_var_name(key);
-	h = FACT_get_hash(vname, strlen(vname));
-	for (p = *(table->buckets + h % table->num_buckets);
-	     p != NULL && p->data->type != UNSET_TYPE;
-	     p = p->next)
-		;
-	if (p == NULL)
-		p = *(table->buckets + h % table->num_buckets)
-			= FACT_malloc(sizeof (struct _entry));
-	*p->data = key;
-	p->next = FACT_malloc(sizeof (struct _entry));
-	p->next->data->type = UNSET_TYPE;
-	p->next->next = NULL;
-	return p->data;
+  size_t i, mask, nsize;
+  struct _entry *p, *old;
+
+  if (table->buckets == NULL) {
+    table->buckets = FACT_malloc (sizeof (struct _entry) * INIT_NUM_BUCKETS);
+    table->num_buckets = INIT_NUM_BUCKETS;
+    table->num_entries = 0;
+    memset (table->buckets, 0, sizeof (struct _entry) * INIT_NUM_BUCKETS);
+  } else if ((table->num_entries + 1) * 4 > table->num_buckets * 3) {
+    /* Keep the load factor under 3/4 by doubling the size and reinserting
+     * every entry. The stored hashes mean nothing has to be rehashed.
+     */
+    old = table->buckets;
+    nsize = table->num_buckets << 1;
+    table->buckets = FACT_malloc (sizeof (struct _entry) * nsize);
+    memset (table->buckets, 0, sizeof (struct _entry) * nsize);
+    for (i = 0, mask = nsize - 1; i < table->num_buckets; i++) {
+      if (old[i].name == NULL)
+	continue;
+      for (p = table->buckets + (old[i].hash & mask);
+	   p->name != NULL;
+	   p = table->buckets + ((p - table->buckets + 1) & mask))
+	;
+      *p = old[i];
+    }
+    table->num_buckets = nsize;
+  }
+
+  /* Now finally we add the entry, in the first unused spot. */
+  mask = table->num_buckets - 1;
+  for (p = table->buckets + (hash & mask);
+       p->name != NULL;
+       p = table->buckets + ((p - table->buckets + 1) & mask))
+    ;
+  p->name = name;
+  p->hash = hash;
+  *p->data = key;
+  table->num_entries++;
+  return p->data;
+}
+
+/* The symbol table, open addressed like the dictionaries. */
+static char **symbols;
+static size_t num_symbols;
+static size_t symbols_size;
+static pthread_mutex_t symbol_lock = PTHREAD_MUTEX_INITIALIZER;
+
+char *FACT_intern (char *name) /* Get the symbol of a name. */
+{
+  size_t i, j, h, len, mask, nsize;
+  char *res, **old;
+
+  len = strlen (name);
+  h = FACT_get_hash (name, len);
+
+  pthread_mutex_lock (&symbol_lock);
+
+  if ((num_symbols + 1) * 4 > symbols_size * 3) {
+    /* Grow the table, placing every symbol by its stored hash. */
+    old = symbols;
+    nsize = (symbols_size == 0) ? 256 : symbols_size << 1;
+    symbols = FACT_malloc (sizeof (char *) * nsize);
+    memset (symbols, 0, sizeof (char *) * nsize);
+    for (i = 0, mask = nsize - 1; i < symbols_size; i++) {
+      if (old[i] == NULL)
+	continue;
+      for (j = FACT_sym_hash (old[i]) & mask; symbols[j] != NULL; j = (j + 1) & mask)
+	;
+      symbols[j] = old[i];
+    }
+    symbols_size = nsize;
+  }
+
+  mask = symbols_size - 1;
+  for (i = h & mask; symbols[i] != NULL; i = (i + 1) & mask) {
+    if (FACT_sym_hash (symbols[i]) == h && !strcmp (symbols[i], name)) {
+      res = symbols[i];
+      goto done;
+    }
+  }
+
+  /* Not interned yet, allocate the hash and the name together. */
+  res = (char *) FACT_malloc_atomic (sizeof (size_t) + len + 1) + sizeof (size_t);
+  FACT_sym_hash (res) = h;
+  memcpy (res, name, len + 1);
+  symbols[i] = res;
+  num_symbols++;
+
+ done:
+  pthread_mutex_unlock (&symbol_lock);
+  return res;
 }
 
 static void sqsort (char **, size_t, size_t);
@@ -138,16 +251,20 @@ void FACT_table_digest (FACT_table_t *table)
 {
   size_t i, k;
   char **items;
-  struct _entry *p;
 
   if (table == NULL || table->num_entries == 0)
     return;
 
   items = FACT_malloc (sizeof (char *) * table->num_entries);
 
-  for (i = k = 0; i < table->num_buckets; i++) {
-    for (p = *(table->buckets + i); p != NULL && p->data->type != UNSET_TYPE; p = p->next)
-      items[k++] = FACT_var_name (*p->data);
+  if (table->buckets == NULL) {
+    for (k = 0; k < table->shape->size; k++)
+      items[k] = table->shape->names[k];
+  } else {
+    for (i = k = 0; i < table->num_buckets; i++) {
+      if (table->buckets[i].name != NULL)
+	items[k++] = table->buckets[i].name;
+    }
   }
 
   /* Sort the entries. */
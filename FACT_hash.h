@@ -22,20 +22,85 @@
 
 #include <string.h>
 
-#define INIT_NUM_BUCKETS 256
+#define INIT_NUM_BUCKETS 64 /* Must be a power of two.                     */
+#define MAX_SHAPE_SLOTS  32 /* Tables bigger than this become dictionaries. */
 
+/* Shapes describe the layout of small tables. A shape maps every name in a
+ * table to an index in the table's slot array. Tables that had the same names
+ * added in the same order share the same shape, since adding a name follows a
+ * transition from the current shape to the next one. Shapes are immutable and
+ * never freed, so a shape pointer identifies a layout.
+ */
+struct FACT_shape {
+  size_t size;                /* Number of slots.                        */
+  char **names;               /* Name of every slot.                     */
+  size_t *hashes;             /* Hash of every slot's name.              */
+  uint64_t bloom;             /* Bloom of all the names in the shape.    */
+  struct FACT_shape *parent;  /* Shape before the last name was added.   */
+  struct FACT_shape **trans;  /* Shapes reached by adding one more name. */
+  size_t num_trans;           /* Number of transitions.                  */
+};
+
+/* A table is in shape mode while buckets is NULL, and in dictionary mode
+ * otherwise. An empty table is in shape mode with no shape.
+ */
 struct _var_table {
-  struct _entry {
+  struct _entry {  /* Open addressed with linear probing.    */
+    char *name;    /* Key of the entry, NULL if unused.      */
+    size_t hash;   /* Hash of the key.                       */
     FACT_t data[1];
-    struct _entry *next;
-  } **buckets;
-  size_t num_buckets;
+  } *buckets;
+  size_t num_buckets; /* Always a power of two.              */
   size_t num_entries;
+  size_t version; /* Bumped on every insertion, used by inline caches. */
+  uint64_t bloom; /* One bit set per hash of every name in the table.  */
+  struct FACT_shape *shape; /* Layout of the table in shape mode.      */
+  FACT_t *slots;            /* Values of the table in shape mode.      */
+  size_t num_slots;         /* Allocated size of slots.                */
 };
 
+/* FACT_bloom_bit(h): Bloom filter bit for a hash. If the bit is not set in
+ * a table's bloom, the name is definitely not in the table.
+ */
+#define FACT_bloom_bit(h) ((uint64_t) 1 << (((h) >> 7) & 63))
+
+/* Symbols are interned identifiers. The hash of a symbol is stored right
+ * before its first character, and two symbols with the same name are the
+ * same pointer. Every name in a table, and every name operand in the
+ * program, is a symbol.
+ */
+char *FACT_intern (char *);
+
+/* FACT_sym_hash(s): precomputed hash of the symbol s. */
+#define FACT_sym_hash(s) (((size_t *) (s))[-1])
+
+/* FACT_SYM(lit): symbol of a string literal, interned on first use. */
+#define FACT_SYM(lit)				\
+  ({ static char *_sym;				\
+    if (_sym == NULL)				\
+      _sym = FACT_intern (lit);			\
+    _sym; })
+
+/* FACT_shape_slot: get the slot of a name in a shape, -1 if it has none. */
+static inline long FACT_shape_slot (struct FACT_shape *shape, char *key, size_t hash)
+{
+  size_t i;
+
+  if (!(shape->bloom & FACT_bloom_bit (hash)))
+    return -1;
+
+  for (i = shape->size; i-- > 0;) {
+    if (shape->hashes[i] == hash
+	&& (shape->names[i] == key || !strcmp (shape->names[i], key)))
+      return i;
+  }
+
+  return -1;
+}
+
 FACT_t *FACT_find_in_table_nohash (FACT_table_t *, char *);
 FACT_t *FACT_find_in_table (FACT_table_t *, char *, size_t);
-FACT_t *FACT_add_to_table (FACT_table_t *, FACT_t);
+FACT_t *FACT_add_to_table (FACT_table_t *, FACT_t); /* The name must be a symbol. */
 void FACT_table_digest (FACT_table_t *);
 
 inline size_t FACT_get_hash (char *, size_t);
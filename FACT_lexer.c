@@ -262,6 +262,12 @@ static FACT_nterm_t get_type (char *token)
       return i;
   }
 
+  /* Typed array declarations work like num, the compiler checks the
+   * lexem for the element type.
+   */
+  if (!strcmp (token, "i64") || !strcmp (token, "f64") || !strcmp (token, "u8"))
+    return E_NUM_DEF;
+
   return ((isdigit (*token) || *token == '.') ? E_NUM : E_VAR);
   /*
   return (is_num (token)
@@ -22,6 +22,8 @@
 #include "FACT_file.h"
 #include "FACT_error.h"
 #include "FACT_opcodes.h"
+#include "FACT_vec.h"
+#include "FACT_sched.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -67,6 +69,7 @@ int main (int argc, char **argv)
     { 'h', "help"            }, /* 5 */
     { 'v', "version"         }, /* 6 */
     { 'd', "disasm"          }, /* 7 */
+    { 'w', "workers"         }, /* 8 */
   };
 
   /* Set exit routines. */
@@ -90,6 +93,7 @@ int main (int argc, char **argv)
   Furlow_add_instruction(nop_inst); /* In case there is no STDLIB. */
   FACT_init_interrupt();
   FACT_add_BIFs();
+  FACT_init_vec();
 
   q_size = 0;
   file_queue = NULL;
@@ -207,15 +211,19 @@ int main (int argc, char **argv)
 
     case 5: /* help            */
       /* Print help message and exit. */
-      printf ("usage: FACT -snhvf [ long options ] [ files ]\n"
+      printf ("usage: FACT -snhvfw [ long options ] [ files ]\n"
 	      "Options and their arguments:\n"
 	      "-s          : force the FACT shell (default behaviour with no arguments)\n"
 	      "-n          : force FACT to not enter interactive mode\n"
 	      "-h          : print this message and exit\n"
 	      "-v          : print the version number and exit\n"
 	      "-f [ file ] : run the specified file\n"
+	      "-w [ n ]    : run threads on n workers (default: $FACT_WORKERS, or one per CPU)\n"
+	      "              threads share workers by taking turns at loops, tail calls and\n"
+	      "              message polls, so a long built-in call holds up its worker\n"
 	      "Long options:\n"
 	      "--file                 : analagous to -f\n"
+	      "--workers              : analagous to -w\n"
 	      "--shell=<yes|no>       : force the shell to enter or not to enter.\n"
 	      "--load-stdlib=<yes|no> : force the loading or the ignoring of the FACT standard library.\n"
 	      "--help                 : analagous to -h\n"
@@ -236,6 +244,16 @@ int main (int argc, char **argv)
       disasm = true;
       break;
 
+    case 8: /* workers         */
+      /* Set the size of the thread pool. */
+      if (argv[i + 1] == NULL || atoi (argv[i + 1]) <= 0) {
+	fprintf (stderr, "FACT: Expected a number of workers.\n");
+	goto exit;
+      }
+      FACT_sched_workers (atoi (argv[i + 1]));
+      i++;
+      continue;
+
     default: /* DOESNOTREACH   */
       abort ();
       break;
@@ -252,7 +270,7 @@ int main (int argc, char **argv)
   }
 
   /* Set the error handler before running any files. */
-  if (setjmp (recover)) {
+  if (setjmp (curr_thread->recover)) {
     /* Print out the error and a stack trace. */
     fprintf (stderr, "Caught unhandled error: %s\n", curr_thread->curr_err.what);
     while (curr_thread->cstackp - curr_thread->cstack >= 0) {
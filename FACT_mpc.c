@@ -85,6 +85,16 @@ void mpc_set_si (mpc_t rop, signed long op)
   mpz_set_si (rop->intv, op);
 }
 
+void mpc_set_d (mpc_t rop, double op)
+{
+  if (!rop->fp) {
+    rop->fp = true;
+    mpz_clear (rop->intv);
+    mpf_init (rop->fltv);
+  }
+  mpf_set_d (rop->fltv, op);
+}
+
 void mpc_set_str (mpc_t rop, char *str, int base) /* Convert a string to an mpc type. */
 {
   if (base < 0 || strchr (str, '.') != NULL) { /* Floating point number. */
@@ -390,6 +400,13 @@ signed long int mpc_get_si (mpc_t op)
   return mpz_get_si (op->intv);
 }
 
+double mpc_get_d (mpc_t op)
+{
+  if (op->fp)
+    return mpf_get_d (op->fltv);
+  return mpz_get_d (op->intv);
+}
+
 char *
 mpc_get_str (mpc_t op)
 {
@@ -45,6 +45,7 @@ void mpc_set (mpc_t, mpc_t);
 void mpc_set_ui (mpc_t, unsigned long);
 void mpc_set_si (mpc_t, signed long);
 void mpc_set_str (mpc_t, char *, int);
+void mpc_set_d (mpc_t, double);
 
 /* Arithmetic functions. */
 void mpc_add (mpc_t, mpc_t, mpc_t);
@@ -66,6 +67,7 @@ int mpc_cmp_si (mpc_t, signed long int);
 
 unsigned long int mpc_get_ui (mpc_t);
 signed long int mpc_get_si (mpc_t);
+double mpc_get_d (mpc_t);
 char *mpc_get_str (mpc_t);
 
 static inline void mpc_add_ui (mpc_t rop, mpc_t op1, unsigned long int op2)
@@ -20,16 +20,57 @@
 #include "FACT_error.h"
 #include "FACT_types.h"
 #include "FACT_alloc.h"
+#include "FACT_num.h"
 
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
 
-static FACT_num_t *make_num_array (char *, size_t, size_t *, size_t);
-static FACT_num_t copy_num (FACT_num_t);
+static void def_num (char *, char *, FACT_pack_t);
+static void make_num_array (FACT_num_t, size_t, size_t *, size_t, FACT_pack_t);
+static void copy_into (FACT_num_t, FACT_num_t);
 static void free_num (FACT_num_t);
+static void load_elem (mpc_t, FACT_num_t, size_t);
+static void store_elem (FACT_num_t, size_t, mpc_t);
+static void promote (FACT_num_t);
+static inline bool is_byte (mpc_t);
+static void *new_pack (FACT_pack_t, size_t);
+static uint8_t *grow_bytes (FACT_num_t, size_t);
+static bool bytes_like (FACT_num_t);
+static void put_bytes (uint8_t *, FACT_num_t);
+static int compare_packs (FACT_num_t, FACT_num_t, size_t);
+static uint64_t value_key (mpc_t);
+static uint64_t double_key (double);
+
+/* Size in bytes of each type of typed array element. */
+static const size_t pack_width[] = {
+  [PACK_I64] = sizeof (int64_t),
+  [PACK_F64] = sizeof (double),
+  [PACK_U8]  = sizeof (uint8_t),
+  [PACK_BYTES] = sizeof (uint8_t),
+};
+
+/* Byte strings have a header in front of their bytes. Concatenation
+ * lets strings share a buffer: used is how far it has been written, so
+ * a string that ends there may grow in place without touching anyone
+ * else's bytes. Shared buffers are copied before being written to.
+ */
+struct bytes_header {
+  size_t cap;  /* Bytes allocated after the header. */
+  size_t used; /* Bytes in use.                     */
+  bool shared; /* Set if more than one string uses the buffer. */
+};
+
+#define BYTES_HEADER(p) ((struct bytes_header *) (p) - 1)
 
 FACT_num_t FACT_add_num (FACT_scope_t curr, char *name) /* Add a number variable to a scope. */
 {
-  size_t i;
+  return FACT_add_num_sym (curr, FACT_intern (name));
+}
+
+FACT_num_t FACT_add_num_sym (FACT_scope_t curr, char *name) /* Same as FACT_add_num, name must be a symbol. */
+{
+  size_t i, h;
   FACT_t new;
   FACT_t *check;
 
@@ -37,7 +78,8 @@ FACT_num_t FACT_add_num (FACT_scope_t curr, char *name) /* Add a number variable
     FACT_throw_error (curr, "variables may not be defined in a locked scope");
 
   /* Check if the variable already exists. */
-  check = FACT_find_in_table_nohash (curr->vars, name);
+  h = FACT_sym_hash (name);
+  check = FACT_find_in_table (curr->vars, name, h);
   
   if (check != NULL) { /* The variable already exists. */
     if (check->type == NUM_TYPE) {
@@ -50,11 +92,18 @@ FACT_num_t FACT_add_num (FACT_scope_t curr, char *name) /* Add a number variable
 
       mpc_set_ui (temp->value, 0);
 
-      for (i = 0; i < temp->array_size; i++)
+      for (i = 0; temp->pack == NULL && i < temp->array_size; i++)
 	free_num (temp->array_up[i]);
       
       FACT_free (temp->array_up);
+      /* Byte string buffers may be shared with temporaries. */
+      if (temp->pack_type != PACK_BYTES)
+	FACT_free (temp->pack);
       temp->array_up = NULL;
+      temp->array_cap = 0;
+      temp->pack = NULL;
+      temp->pack_type = PACK_NONE;
+      temp->hash = 0;
       temp->array_size = 0;
       return temp;
     } else /* If it's already a scope, however, just throw an error. */
@@ -69,6 +118,27 @@ FACT_num_t FACT_add_num (FACT_scope_t curr, char *name) /* Add a number variable
 }
 
 void FACT_def_num (char *args, bool anonymous) /* Define a local or anonymous number variable. */
+{
+  def_num (args, anonymous ? NULL : Furlow_sym_arg (args + 1), PACK_NONE);
+}
+
+void FACT_def_typed (char *args, FACT_pack_t type) /* Define a local typed array. */
+{
+  def_num (args, Furlow_sym_arg (args + 5), type);
+}
+
+FACT_num_t FACT_make_typed (FACT_pack_t type, size_t n) /* Make an anonymous one-dimensional typed array. */
+{
+  FACT_num_t res;
+
+  res = FACT_alloc_num ();
+  res->array_size = n;
+  res->pack_type = type;
+  res->pack = new_pack (type, n);
+  return res;
+}
+
+static void def_num (char *args, char *name, FACT_pack_t type) /* Define a number, or an anonymous one if name is NULL. */
 {
   mpc_t elem_value;
   FACT_t push_val;
@@ -80,9 +150,9 @@ void FACT_def_num (char *args, bool anonymous) /* Define a local or anonymous nu
   dimensions = mpc_get_ui (((FACT_num_t) Furlow_reg_val (args[0], NUM_TYPE))->value);
 
   /* Add or allocate the variable. */
-  push_val.ap = (anonymous
+  push_val.ap = (name == NULL
 		 ? FACT_alloc_num () /* Perhaps add to a heap? */
-		 : FACT_add_num (CURR_THIS, args + 1));
+		 : FACT_add_num_sym (CURR_THIS, name));
   push_val.type = NUM_TYPE;
 
   if (!dimensions)
@@ -111,8 +181,7 @@ void FACT_def_num (char *args, bool anonymous) /* Define a local or anonymous nu
   }
   
   /* Make the variable an array. */
-  ((FACT_num_t) push_val.ap)->array_up = make_num_array (((FACT_num_t) push_val.ap)->name, dimensions, dim_sizes, 0);
-  ((FACT_num_t) push_val.ap)->array_size = dim_sizes[0];
+  make_num_array (push_val.ap, dimensions, dim_sizes, 0, type);
   FACT_free (dim_sizes);
 
   /* Push the variable and return. */
@@ -122,11 +191,21 @@ void FACT_def_num (char *args, bool anonymous) /* Define a local or anonymous nu
 
 void FACT_get_num_elem (FACT_num_t base, char *args)
 {
-  mpc_t elem_value;
   FACT_t push_val;
 
+  /* Get the element and push it to the stack. */
+  push_val.ap = FACT_index_num (base, Furlow_reg_val (args[0], NUM_TYPE));
+  push_val.type = NUM_TYPE;
+
+  push_v (push_val);
+}
+
+FACT_num_t FACT_index_num (FACT_num_t base, FACT_num_t index) /* Get an element of an array by a FACT index. */
+{
+  mpc_t elem_value;
+
   /* Get the element index. */
-  elem_value[0] = *((FACT_num_t) Furlow_reg_val (args[0], NUM_TYPE))->value;
+  elem_value[0] = *index->value;
 
   if (mpc_is_float (elem_value))
     FACT_throw_error (CURR_THIS, "index value must be a positive integer");
@@ -137,40 +216,166 @@ void FACT_get_num_elem (FACT_num_t base, char *args)
       || base->array_size <= mpc_get_ui (elem_value))
     FACT_throw_error (CURR_THIS, "out of bounds error"); /* should elaborate here. */
 
-  /* Get the element and push it to the stack. */
-  push_val.ap = base->array_up[mpc_get_ui (elem_value)];
-  push_val.type = NUM_TYPE;
+  return FACT_get_elem (base, mpc_get_ui (elem_value));
+}
 
-  push_v (push_val);
+FACT_num_t FACT_get_elem (FACT_num_t base, size_t i) /* Get an element of an array, boxing it if the array is typed. */
+{
+  FACT_num_t res;
+
+  if (base->pack == NULL)
+    return base->array_up[i];
+
+  /* Box the element. The box remembers where it came from, so that when
+   * it is changed it can be written back with FACT_sync_num.
+   */
+  res = FACT_alloc_num ();
+  load_elem (res->value, base, i);
+  res->name = base->name;
+  res->locked = base->locked;
+  res->owner = base;
+  res->index = i;
+  return res;
+}
+
+void FACT_sync_num (FACT_num_t elem) /* Write a boxed element back to its typed array. */
+{
+  if (elem->owner->pack_type == PACK_BYTES && elem->array_size != 0)
+    promote (elem->owner);
+
+  if (elem->owner->pack == NULL) {
+    /* The owner was promoted since the element was boxed. */
+    FACT_set_num (elem->owner->array_up[elem->index], elem);
+    return;
+  }
+  
+  if (elem->array_size != 0)
+    FACT_throw_error (CURR_THIS, "elements of a typed array cannot be arrays");
+  store_elem (elem->owner, elem->index, elem->value);
+}
+
+size_t FACT_hash_num (FACT_num_t op) /* Hash a number or array. Equal values hash the same, whatever their representation. */
+{
+  size_t i, h;
+
+  if (op->array_size == 0)
+    h = (2166136261u ^ value_key (op->value)) * 16777619;
+  else if (op->hash != 0)
+    return op->hash;
+  else {
+    /* FNV-1a over the elements' values, so a byte string hashes one byte
+     * at a time.
+     */
+    h = 2166136261u;
+    for (i = 0; i < op->array_size; i++) {
+      switch (op->pack_type) {
+      case PACK_NONE:
+	h ^= ((op->array_up[i]->array_size == 0)
+	      ? value_key (op->array_up[i]->value)
+	      : FACT_hash_num (op->array_up[i]));
+	break;
+
+      case PACK_I64:
+	h ^= (uint64_t) ((int64_t *) op->pack)[i];
+	break;
+
+      case PACK_F64:
+	h ^= double_key (((double *) op->pack)[i]);
+	break;
+
+      case PACK_U8:
+      case PACK_BYTES:
+	h ^= ((uint8_t *) op->pack)[i];
+	break;
+
+      default:
+	abort ();
+      }
+      h *= 16777619;
+    }
+  }
+
+  /* 0 means not computed, so it is never returned. Only typed arrays keep
+   * the hash, as the elements of other arrays can change without them.
+   */
+  if (h == 0)
+    h = 1;
+  if (op->pack != NULL)
+    op->hash = h;
+  return h;
 }
 
 void FACT_set_num (FACT_num_t rop, FACT_num_t op)
 {
   size_t i;
 
+  if (rop == op)
+    return;
+
   /* Free rop. */
-  for (i = 0; i < rop->array_size; i++)
+  for (i = 0; rop->pack == NULL && i < rop->array_size; i++)
     free_num (rop->array_up[i]);
 
+  /* rop's old storage is not freed or reused here, as rop may be the row
+   * of a multi-dimensional array, whose storage is part of a larger block.
+   */
+  rop->array_up = NULL;
+  rop->array_cap = 0;
+  rop->pack = NULL;
+  rop->pack_type = PACK_NONE;
+  rop->hash = 0;
+
   mpc_set (rop->value, op->value);
   rop->array_size = op->array_size;
 
+  if (op->pack != NULL) {
+    /* Typed arrays stay typed when copied. */
+    rop->pack_type = op->pack_type;
+    if (op->pack_type == PACK_BYTES) {
+      /* Byte strings share the buffer until one of them is written to. */
+      BYTES_HEADER (op->pack)->shared = true;
+      rop->pack = op->pack;
+      rop->hash = op->hash;
+      return;
+    }
+    rop->pack = new_pack (op->pack_type, op->array_size);
+    memcpy (rop->pack, op->pack, pack_width[op->pack_type] * op->array_size);
+    rop->hash = op->hash;
+    return;
+  }
+
   if (rop->array_size)
-    rop->array_up = FACT_realloc (rop->array_up, sizeof (FACT_num_t) * op->array_size);
-  else {
-    FACT_free (rop->array_up);
-    rop->array_up = NULL;
+    rop->array_up = FACT_alloc_num_array (op->array_size);
+  else
     return; /* Nothing left to do here. */
-  }
   
   for (i = 0; i < rop->array_size; i++)
-    rop->array_up[i] = copy_num (op->array_up[i]);
+    copy_into (rop->array_up[i], op->array_up[i]);
+}
+
+bool FACT_equal_num (FACT_num_t op1, FACT_num_t op2) /* Check if op1 and op2 are equal, quicker than FACT_compare_num. */
+{
+  if (op1->array_size != op2->array_size)
+    return false;
+  if (op1->array_size == 0)
+    return mpc_cmp (op1->value, op2->value) == 0;
+
+  /* Hashes that were already computed can rule out a match for free. */
+  if (op1->hash != 0 && op2->hash != 0 && op1->hash != op2->hash)
+    return false;
+
+  if ((bytes_like (op1) && bytes_like (op2))
+      || (op1->pack_type == PACK_I64 && op2->pack_type == PACK_I64))
+    return !memcmp (op1->pack, op2->pack, pack_width[op1->pack_type] * op1->array_size);
+
+  return FACT_compare_num (op1, op2) == 0;
 }
 
 int FACT_compare_num (FACT_num_t op1, FACT_num_t op2) /* Return -1 if op1 is < op2, 0 if they are equal, and 1 if op1 is greater. */
 {
   size_t i, min_size;
   int res;
+  FACT_num_t e1, e2;
   
   if (op1->array_size == 0) {
     if (op2->array_size != 0)
@@ -183,11 +388,29 @@ int FACT_compare_num (FACT_num_t op1, FACT_num_t op2) /* Return -1 if op1 is < o
       return 1;
     
     min_size = (op1->array_size > op2->array_size ? op2->array_size : op1->array_size);
-    for (i = 0; i < min_size; i++) {
-      res = FACT_compare_num (op1->array_up[i], op2->array_up[i]);
-      if (res != 0)
-	return res;
+    if (op1->pack_type != PACK_NONE
+	&& (op1->pack_type == op2->pack_type || (bytes_like (op1) && bytes_like (op2))))
+      res = compare_packs (op1, op2, min_size);
+    else {
+      for (i = res = 0; i < min_size && res == 0; i++) {
+	if (op1->pack == NULL && op2->pack == NULL) {
+	  e1 = op1->array_up[i];
+	  e2 = op2->array_up[i];
+	  /* Integers are compared directly, skipping the checks below. */
+	  if (e1->array_size == 0 && e2->array_size == 0 && !e1->value->fp && !e2->value->fp) {
+	    res = mpz_cmp (e1->value->intv, e2->value->intv);
+	    res = (res > 0) - (res < 0);
+	    continue;
+	  }
+	} else {
+	  e1 = FACT_get_elem (op1, i);
+	  e2 = FACT_get_elem (op2, i);
+	}
+	res = FACT_compare_num (e1, e2);
+      }
     }
+    if (res != 0)
+      return res;
     
     /* Now just go by whichever is the bigger array, or return 0. */
     return ((op1->array_size > op2->array_size)
@@ -195,53 +418,121 @@ int FACT_compare_num (FACT_num_t op1, FACT_num_t op2) /* Return -1 if op1 is < o
 	    : ((op1->array_size < op2->array_size)
 	       ? -1
 	       : 0));
-    /*
-    if (op1->array_size > op2->array_size)
-      return 1;
-    else if (op1->array_size < op2->array_size)
-      return -1;
-    else
-      return 0;
-    */
   }
-}     
+}
 
-void FACT_append_num (FACT_num_t op1, FACT_num_t op2)
+void FACT_append_num (FACT_num_t op1, FACT_num_t op2, bool move) /* Append op2 to op1. If move is set, op2 is a temporary and is used as the new element. */
 {
-  size_t offset;
-  
-  /* Move the op1 to an array if it isn't one already. */
-  if (op1->array_size == 0) {
-    op1->array_size = 1;
-    op1->array_up = FACT_alloc_num_array (1);
+  size_t cap;
+  void *elems;
+
+  if (op1->owner != NULL)
+    FACT_throw_error (CURR_THIS, "elements of a typed array cannot be arrays");
+
+  if (op1->pack_type == PACK_BYTES
+      && (op2->array_size != 0 || !is_byte (op2->value)))
+    promote (op1);
+
+  if (op1->pack_type == PACK_BYTES) {
+    /* The new byte is past the end of anyone sharing the buffer. */
+    *grow_bytes (op1, 1) = mpc_get_ui (op2->value);
+    op1->array_size++;
+    return;
+  }
+
+  /* Typed arrays can only have numbers appended to them. */
+  if (op1->pack != NULL && op2->array_size != 0)
+    FACT_throw_error (CURR_THIS, "elements of a typed array cannot be arrays");
+
+  /* Move the op1 to an array if it isn't one already. Leave room for the
+   * appends that are likely to follow.
+   */
+  if (op1->pack == NULL && op1->array_size == 0) {
+    op1->array_up = FACT_malloc (sizeof (FACT_num_t) * 4);
+    op1->array_up[0] = FACT_alloc_num ();
     mpc_set (op1->array_up[0]->value, op1->value);
     mpc_set_ui (op1->value, 0);
+    op1->array_size = 1;
+    op1->array_cap = 4;
   }
-  
-  offset = op1->array_size;
-  op1->array_size++;
-  op1->array_up = FACT_realloc (op1->array_up, sizeof (FACT_num_t) * op1->array_size);
-
-  op1->array_up[offset] = FACT_alloc_num ();
-  FACT_set_num (op1->array_up[offset], op2);
-
-  /*
-   * Todo: clone this function and add the following:
-   *
-  if (op2->array_size == 0)
-    {
-      op1->array_up[offset] = FACT_alloc_num ();
-      mpc_set (op1->array_up[offset]->value, op2->value);
+
+  /* Grow geometrically, so that building an array by appending is linear.
+   * The elements are copied rather than reallocated, since they may be a
+   * row of a larger array.
+   */
+  if (op1->array_size >= op1->array_cap) {
+    cap = (op1->array_size < 2) ? 4 : op1->array_size * 2;
+    if (op1->pack != NULL) {
+      elems = FACT_malloc_atomic (pack_width[op1->pack_type] * cap);
+      memcpy (elems, op1->pack, pack_width[op1->pack_type] * op1->array_size);
+      op1->pack = elems;
+    } else {
+      elems = FACT_malloc (sizeof (FACT_num_t) * cap);
+      memcpy (elems, op1->array_up, sizeof (FACT_num_t) * op1->array_size);
+      op1->array_up = elems;
     }
-  else
-    {
-      for (i = 0; i < op2->array_size; i++)
-	{
-	  op1->array_up[offset + i] = FACT_alloc_num ();
-	  FACT_set_num (op1->array_up[offset + i], op2->array_up[i]);
-	}
+    op1->array_cap = cap;
+  }
+
+  if (op1->pack != NULL)
+    store_elem (op1, op1->array_size, op2->value);
+  else if (move)
+    op1->array_up[op1->array_size] = op2;
+  else {
+    op1->array_up[op1->array_size] = FACT_alloc_num ();
+    FACT_set_num (op1->array_up[op1->array_size], op2);
+  }
+  op1->array_size++;
+}
+
+FACT_num_t FACT_concat_num (FACT_num_t op1, FACT_num_t op2) /* Join two arrays, or numbers, into a new array. */
+{
+  size_t i, n1, n2;
+  FACT_num_t res;
+
+  /* Numbers count as arrays of one. */
+  n1 = (op1->array_size != 0) ? op1->array_size : 1;
+  n2 = (op2->array_size != 0) ? op2->array_size : 1;
+  res = FACT_alloc_num ();
+  
+  if (bytes_like (op1) && bytes_like (op2)) {
+    res->pack_type = PACK_BYTES;
+    if (op1->pack_type == PACK_BYTES) {
+      /* Start out as op1, so that op2 can be put in op1's buffer if
+       * nothing follows it.
+       */
+      res->pack = op1->pack;
+      BYTES_HEADER (res->pack)->shared = true;
+    } else {
+      res->pack = new_pack (PACK_BYTES, n1);
+      put_bytes (res->pack, op1);
     }
-  */
+    res->array_size = n1;
+    put_bytes (grow_bytes (res, n2), op2);
+    res->array_size += n2;
+    return res;
+  }
+
+  res->array_size = n1 + n2;
+  res->array_up = FACT_alloc_num_array (n1 + n2);
+  for (i = 0; i < n1; i++)
+    FACT_set_num (res->array_up[i], (op1->array_size != 0) ? FACT_get_elem (op1, i) : op1);
+  for (i = 0; i < n2; i++)
+    FACT_set_num (res->array_up[n1 + i], (op2->array_size != 0) ? FACT_get_elem (op2, i) : op2);
+
+  return res;
+}
+
+void FACT_own_num (FACT_num_t str) /* Give a byte string a buffer of its own before it is written to. */
+{
+  uint8_t *old;
+
+  if (str->pack_type != PACK_BYTES || !BYTES_HEADER (str->pack)->shared)
+    return;
+
+  old = str->pack;
+  str->pack = new_pack (PACK_BYTES, str->array_size);
+  memcpy (str->pack, old, str->array_size);
 }
 
 void FACT_lock_num (FACT_num_t root)
@@ -249,63 +540,292 @@ void FACT_lock_num (FACT_num_t root)
   size_t i;
 
   root->locked = true;
-  for (i = 0; i < root->array_size; i++)
+  for (i = 0; root->pack == NULL && i < root->array_size; i++)
     FACT_lock_num (root->array_up[i]);
 }
 
-static FACT_num_t *make_num_array (char *name, size_t dims, size_t *dim_sizes, size_t curr_dim)
+static void make_num_array (FACT_num_t arr, size_t dims, size_t *dim_sizes, size_t curr_dim, FACT_pack_t type)
 {
-  size_t i;
-  FACT_num_t *root;
+  size_t i, n, count;
+  char *pack;
+  FACT_num_t *level, *next;
+
+  /* Each dimension is allocated as one block, and the rows of the
+   * dimension above it are views into that block. So all the elements
+   * of the array sit next to each other, and a[i][j] only reads memory
+   * in a few places no matter how the array was made.
+   */
+  level = &arr;
+  count = 1;
   
-  if (curr_dim >= dims)
-    return NULL;
+  for (; curr_dim < dims; curr_dim++) {
+    n = dim_sizes[curr_dim];
+
+    /* The last dimension of a typed array is kept packed. */
+    if (type != PACK_NONE && curr_dim == dims - 1) {
+      pack = FACT_malloc_atomic (pack_width[type] * n * count);
+      for (i = 0; i < count; i++) {
+	level[i]->array_size = n;
+	level[i]->pack_type = type;
+	level[i]->pack = pack + pack_width[type] * n * i;
+      }
+      return;
+    }
 
-  root = FACT_alloc_num_array (dim_sizes[curr_dim]);
+    next = FACT_alloc_num_array (n * count);
+    for (i = 0; i < count; i++) {
+      level[i]->array_size = n;
+      level[i]->array_up = next + n * i;
+    }
+    for (i = 0; i < n * count; i++)
+      next[i]->name = arr->name;
 
-  for (i = 0; i < dim_sizes[curr_dim]; i++) {
-    root[i]->name = name;
-    root[i]->array_up = make_num_array (name, dims, dim_sizes, curr_dim + 1);
-    /* Could be optimized not to check every single time. */
-    if (root[i]->array_up != NULL)
-      root[i]->array_size = dim_sizes[curr_dim + 1];
+    level = next;
+    count *= n;
   }
-  
-  return root;
 }
       
-static FACT_num_t copy_num (FACT_num_t root) /* Copy a number array recursively. */
+static void copy_into (FACT_num_t res, FACT_num_t root) /* Copy a number array into a new number. */
 {
   size_t i;
-  FACT_num_t res;
 
-  if (root == NULL)
-    return NULL;
-  
-  res = FACT_alloc_num ();
   res->array_size = root->array_size;
-  res->array_up = ((root->array_up != NULL)
-		   ? FACT_malloc (sizeof (FACT_num_t) * res->array_size)
-		   : NULL);
   mpc_set (res->value, root->value);
 
-  for (i = 0; i < root->array_size; i++)
-    res->array_up[i] = copy_num (root->array_up[i]);
+  if (root->pack != NULL) {
+    res->pack_type = root->pack_type;
+    res->pack = new_pack (root->pack_type, root->array_size);
+    memcpy (res->pack, root->pack, pack_width[root->pack_type] * root->array_size);
+    res->hash = root->hash;
+    return;
+  }
 
-  return res;
+  if (root->array_up == NULL)
+    return;
+
+  /* Each dimension's elements are allocated in one block. */
+  res->array_up = FACT_alloc_num_array (res->array_size);
+  for (i = 0; i < root->array_size; i++)
+    copy_into (res->array_up[i], root->array_up[i]);
 }
 
-static void free_num (FACT_num_t root) /* Free a number array recursively. */
+static void free_num (FACT_num_t root) /* Free the values of a number array recursively. */
 {
   size_t i;
 
   if (root == NULL)
     return;
 
-  for (i = 0; i < root->array_size; i++)
+  for (i = 0; root->pack == NULL && i < root->array_size; i++)
     free_num (root->array_up[i]);
 
+  /* Numbers and their rows are allocated in blocks, so only the values
+   * can be freed here. The rest is left to the collector.
+   */
   mpc_clear (root->value);
-  FACT_free (root->array_up);
-  FACT_free (root);
+}
+
+static void load_elem (mpc_t rop, FACT_num_t arr, size_t i) /* Read an element of a typed array. */
+{
+  switch (arr->pack_type) {
+  case PACK_I64:
+    mpc_set_si (rop, ((int64_t *) arr->pack)[i]);
+    break;
+
+  case PACK_F64:
+    mpc_set_d (rop, ((double *) arr->pack)[i]);
+    break;
+
+  case PACK_U8:
+  case PACK_BYTES:
+    mpc_set_ui (rop, ((uint8_t *) arr->pack)[i]);
+    break;
+
+  default:
+    abort ();
+  }
+}
+
+static void store_elem (FACT_num_t arr, size_t i, mpc_t op) /* Write an element of a typed array. */
+{
+  arr->hash = 0;
+
+  /* Floats stored in integer arrays are truncated, like floor. Values
+   * that don't fit are an error rather than wrapping around.
+   */
+  switch (arr->pack_type) {
+  case PACK_I64:
+    if (mpc_is_float (op)
+	? !mpf_fits_slong_p (op->fltv)
+	: !mpz_fits_slong_p (op->intv))
+      FACT_throw_error (CURR_THIS, "value does not fit in an i64 array");
+    ((int64_t *) arr->pack)[i] = mpc_get_si (op);
+    break;
+
+  case PACK_F64:
+    ((double *) arr->pack)[i] = mpc_get_d (op);
+    if (!isfinite (((double *) arr->pack)[i]))
+      FACT_throw_error (CURR_THIS, "value does not fit in an f64 array");
+    break;
+
+  case PACK_U8:
+    if (mpc_cmp_si (op, 0) < 0 || mpc_cmp_ui (op, UINT8_MAX + 1) >= 0)
+      FACT_throw_error (CURR_THIS, "value does not fit in a u8 array");
+    ((uint8_t *) arr->pack)[i] = mpc_get_ui (op);
+    break;
+
+  case PACK_BYTES:
+    if (!is_byte (op)) {
+      promote (arr);
+      mpc_set (arr->array_up[i]->value, op);
+    } else {
+      FACT_own_num (arr);
+      ((uint8_t *) arr->pack)[i] = mpc_get_ui (op);
+    }
+    break;
+
+  default:
+    abort ();
+  }
+}
+
+static void promote (FACT_num_t str) /* Turn a byte string into an ordinary array. */
+{
+  size_t i;
+  FACT_num_t *elems;
+
+  elems = FACT_alloc_num_array (str->array_size);
+  for (i = 0; i < str->array_size; i++) {
+    mpc_set_ui (elems[i]->value, ((uint8_t *) str->pack)[i]);
+    elems[i]->name = str->name;
+  }
+
+  str->array_up = elems;
+  str->array_cap = 0;
+  str->pack = NULL;
+  str->pack_type = PACK_NONE;
+  str->hash = 0;
+}
+
+static void *new_pack (FACT_pack_t type, size_t n) /* Allocate the elements of a typed array. */
+{
+  struct bytes_header *h;
+
+  if (type != PACK_BYTES)
+    return FACT_malloc_atomic (pack_width[type] * (n ? n : 1));
+
+  h = FACT_malloc_atomic (sizeof (struct bytes_header) + (n ? n : 1));
+  h->cap = h->used = n;
+  h->shared = false;
+  return h + 1;
+}
+
+static uint8_t *grow_bytes (FACT_num_t str, size_t extra) /* Make room for more bytes at the end of a byte string, and return it. */
+{
+  size_t n, cap, used;
+  uint8_t *old;
+  struct bytes_header *h;
+
+  n = used = str->array_size;
+  h = BYTES_HEADER (str->pack);
+
+  /* The buffer may be shared with strings in other threads (locked
+   * strings are sent by reference), so the space is claimed atomically.
+   */
+  if (h->cap - n < extra
+      || !__atomic_compare_exchange_n (&h->used, &used, n + extra, false,
+				       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    /* Another string's bytes come after ours, or there isn't room. Move
+     * to a new buffer, doubling it so that repeated growth is amortized.
+     */
+    cap = (n + extra) * 2;
+    old = str->pack;
+    str->pack = new_pack (PACK_BYTES, (cap < 16) ? 16 : cap);
+    memcpy (str->pack, old, n);
+    BYTES_HEADER (str->pack)->used = n + extra;
+  }
+
+  str->hash = 0;
+  return (uint8_t *) str->pack + n;
+}
+
+static bool bytes_like (FACT_num_t op) /* Check if a number or array can be put in a byte string as is. */
+{
+  return (op->pack_type == PACK_BYTES
+	  || op->pack_type == PACK_U8
+	  || (op->array_size == 0 && is_byte (op->value)));
+}
+
+static void put_bytes (uint8_t *dst, FACT_num_t op) /* Copy the bytes of a byte-like number or array. */
+{
+  if (op->array_size == 0)
+    *dst = mpc_get_ui (op->value);
+  else
+    memcpy (dst, op->pack, op->array_size);
+}
+
+static inline bool is_byte (mpc_t op) /* Check if a value can be stored in a byte string. */
+{
+  return (mpc_is_int (op)
+	  && mpc_cmp_si (op, 0) >= 0
+	  && mpc_cmp_ui (op, UINT8_MAX) <= 0);
+}
+
+static int compare_packs (FACT_num_t op1, FACT_num_t op2, size_t n) /* Compare the first n elements of two typed arrays of the same kind. */
+{
+  int res;
+  size_t i;
+  int64_t *q1, *q2;
+  double *d1, *d2;
+
+  switch (op1->pack_type) {
+  case PACK_U8:
+  case PACK_BYTES:
+    /* Bytes compare the same way their values do. */
+    res = memcmp (op1->pack, op2->pack, n);
+    return (res > 0) - (res < 0);
+
+  case PACK_I64:
+    q1 = op1->pack;
+    q2 = op2->pack;
+    for (i = 0; i < n && q1[i] == q2[i]; i++)
+      ;
+    return (i == n) ? 0 : ((q1[i] > q2[i]) ? 1 : -1);
+
+  case PACK_F64:
+    d1 = op1->pack;
+    d2 = op2->pack;
+    for (i = 0; i < n && d1[i] == d2[i]; i++)
+      ;
+    return (i == n) ? 0 : ((d1[i] > d2[i]) ? 1 : -1);
+
+  default:
+    abort ();
+  }
+}
+
+static uint64_t value_key (mpc_t op) /* Reduce a value to 64 bits for hashing. */
+{
+  /* Integral values use their integer value whether they are stored as
+   * floats or not, so that values that compare equal hash the same.
+   */
+  if (op->fp) {
+    if (mpf_integer_p (op->fltv) && mpf_fits_slong_p (op->fltv))
+      return (uint64_t) mpf_get_si (op->fltv);
+    return double_key (mpf_get_d (op->fltv));
+  }
+  
+  if (mpz_fits_slong_p (op->intv))
+    return (uint64_t) mpz_get_si (op->intv);
+  return double_key (mpz_get_d (op->intv));
+}
+
+static uint64_t double_key (double d) /* Same as value_key, for doubles. */
+{
+  uint64_t bits;
+
+  if (d == floor (d) && d >= -0x1p63 && d < 0x1p63)
+    return (uint64_t) (int64_t) d;
+  memcpy (&bits, &d, sizeof bits);
+  return bits;
 }
@@ -17,18 +17,30 @@
 #ifndef FACT_NUM_H_
 #define FACT_NUM_H_
 
+#include "FACT_types.h"
+
 typedef struct FACT_num *FACT_num_t;
 typedef struct FACT_scope *FACT_scope_t;
 
 FACT_num_t FACT_get_local_num (FACT_scope_t, char *);
 FACT_num_t FACT_add_num (FACT_scope_t, char *);
+FACT_num_t FACT_add_num_sym (FACT_scope_t, char *);
 
 int FACT_compare_num (FACT_num_t, FACT_num_t);
+bool FACT_equal_num (FACT_num_t, FACT_num_t);
 
 void FACT_def_num (char *, bool);
+void FACT_def_typed (char *, FACT_pack_t);
+FACT_num_t FACT_make_typed (FACT_pack_t, size_t);
 void FACT_get_num_elem (FACT_num_t, char *);
+FACT_num_t FACT_index_num (FACT_num_t, FACT_num_t);
+FACT_num_t FACT_get_elem (FACT_num_t, size_t);
+void FACT_sync_num (FACT_num_t);
+size_t FACT_hash_num (FACT_num_t);
 void FACT_set_num (FACT_num_t, FACT_num_t);
-void FACT_append_num (FACT_num_t, FACT_num_t);
+void FACT_append_num (FACT_num_t, FACT_num_t, bool);
+FACT_num_t FACT_concat_num (FACT_num_t, FACT_num_t);
+void FACT_own_num (FACT_num_t);
 void FACT_lock_num (FACT_num_t);
 
 #endif /* FACT_NUM_H_ */
@@ -35,15 +35,18 @@ typedef enum Furlow_opcode {
   DEC,     /* Decrement a register by 1.                     */
   DEF_N,   /* Define a new number in the this scope.         */
   DEF_S,   /* Define a new scope in the this scope.          */
+  DEF_T,   /* Define a new typed array in the this scope.    */
   DIE,     /* Kills a thread.                                */
   DIV,     /* Division.                                      */
   DROP,    /* Drop the first item on the var stack.          */
   DUP,     /* Duplicate the first element on the var stack.  */
   ELEM,    /* Get the element of an array.                   */
+  ELEMS,   /* Get an element of a multi-dimensional array.   */
   EXIT,    /* Like ret, except the ip is left unchanged.     */
   GLOBAL,  /* Make a variable global.                        */
   GOTO,    /* Jump to a function but do not push.            */
   GROUP,   /* Group elements on the var stack into an array. */
+  GVAR,    /* Push a constant global by its slot.            */
   HALT,    /* Halt execution.                                */
   INC,     /* Increment a register by 1.                     */
   IOR,     /* Bitwise inclusive OR.                          */
@@ -58,6 +61,7 @@ typedef enum Furlow_opcode {
   LAMBDA,  /* Push a lambda scope to the stack.              */
   LOCK,    /* Make a variable immutable.                     */
   MOD,     /* Modulo.                                        */
+  MOVE,    /* Append a temporary without copying it.         */
   MUL,     /* Multiplication.                                */
   NAME,    /* Set the name of a scope.                       */
   NEG,     /* Negative.                                      */
@@ -67,15 +71,21 @@ typedef enum Furlow_opcode {
   PURGE,   /* Remove all items from the var stack.           */
   REF,     /* Create a reference.                            */
   RET,     /* Pop the call stack.                            */
+  RET_F,   /* Pop the call stack and recycle the frame.      */
   SET_C,   /* Set the jump address of a function.            */
   SET_F,   /* Set the function data of a scope.              */
+  SET_U,   /* Set the up link of a scope.                    */
   SPRT,    /* Create a new thread and unconditionally jump.  */    
   STO,     /* Copy one var to the other.                     */
+  STR,     /* Push a new string to the var stack.            */
   SUB,     /* Subraction.                                    */    
   SWAP,    /* Swap the first two elements on the var stack.  */
+  TCALL,   /* Replace the current call frame with a call.    */
+  TCALL_F, /* Same as TCALL, and recycle the frame.          */
   THIS,    /* Push the this scope to the variable stack.     */
   TRAP_B,  /* Push to the trap stack.                        */
   TRAP_E,  /* Pop the trap stack.                            */
+  UP,      /* Push the up scope to the variable stack.       */
   USE,     /* Push to the call stack.                        */
   VAR,     /* Retrieve and push a variable to the stack.     */
   VA_ADD,  /* Add a variable to a scope's var arg list.      */
@@ -89,6 +99,7 @@ static struct {
 			      *  r = register (1 byte)
 			      *  a = segment address (4 bytes)
 			      *  s = string (n bytes null terminated)
+			      *  n = symbol (pointer to an interned name)
 			      */
 } Furlow_instructions[] = {
   { "add"     , ADD     , "rrr" },
@@ -105,22 +116,25 @@ static struct {
   { "consti"  , CONSTI  , "a"   },
   { "constu"  , CONSTU  , "a"   },
   { "dec"     , DEC     , "r"   },
-  { "def_n"   , DEF_N   , "rs"  },
-  { "def_s"   , DEF_S   , "rs"  },
+  { "def_n"   , DEF_N   , "rn"  },
+  { "def_s"   , DEF_S   , "rn"  },
+  { "def_t"   , DEF_T   , "ran" },
   { "die"     , DIE     , ""    },
   { "div"     , DIV     , "rrr" },
   { "drop"    , DROP    , ""    },
   { "dup"     , DUP     , ""    },
   { "elem"    , ELEM    , "rr"  },
+  { "elems"   , ELEMS   , "ra"  },
   { "exit"    , EXIT    , ""    },
-  { "global"  , GLOBAL  , "rs"  },
+  { "global"  , GLOBAL  , "rn"  },
   { "goto"    , GOTO    , "r"   },
   { "group"   , GROUP   , "r"   },
+  { "gvar"    , GVAR    , "an"  },
   { "halt"    , HALT    , ""    },
   { "inc"     , INC     , "r"   },
   { "ior"     , IOR     , "rrr" },
-  { "is_auto" , IS_AUTO , "s"   },
-  { "is_def"  , IS_DEF  , "s"   },
+  { "is_auto" , IS_AUTO , "n"   },
+  { "is_def"  , IS_DEF  , "n"   },
   { "jmp"     , JMP     , "a"   },
   { "jmp_pnt" , JMP_PNT , "a"   },
   { "jif"     , JIF     , "ra"  },
@@ -130,6 +144,7 @@ static struct {
   { "lambda"  , LAMBDA  , ""    },
   { "lock"    , LOCK    , "r"   },
   { "mod"     , MOD     , "rrr" },
+  { "move"    , MOVE    , "rr"  },
   { "mul"     , MUL     , "rrr" },
   { "name"    , NAME    , "rr"  },
   { "neg"     , NEG     , "r"   },
@@ -139,17 +154,23 @@ static struct {
   { "purge"   , PURGE   , ""    },
   { "ref"     , REF     , "rr"  },
   { "ret"     , RET     , ""    },
+  { "ret_f"   , RET_F   , ""    },
   { "set_c"   , SET_C   , "ra"  },
   { "set_f"   , SET_F   , "rr"  },
+  { "set_u"   , SET_U   , "rr"  },
   { "sprt"    , SPRT    , "a"   },
   { "sto"     , STO     , "rr"  },
+  { "str"     , STR     , "s"   },
   { "sub"     , SUB     , "rrr" },
   { "swap"    , SWAP    , ""    },
+  { "tcall"   , TCALL   , "r"   },
+  { "tcall_f" , TCALL_F , "r"   },
   { "this"    , THIS    , ""    },
   { "trap_b"  , TRAP_B  , "a"   },
   { "trap_e"  , TRAP_E  , ""    },
+  { "up"      , UP      , ""    },
   { "use"     , USE     , "r"   },
-  { "var"     , VAR     , "s"   },
+  { "var"     , VAR     , "n"   },
   { "va_add"  , VA_ADD  , "rr"  },
   { "xor"     , XOR     , "rrr" },
 };
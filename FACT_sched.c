@@ -0,0 +1,356 @@
+/* This file is part of FACT.
+ *
+ * FACT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FACT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FACT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FACT.h"
+#include "FACT_types.h"
+#include "FACT_alloc.h"
+#include "FACT_vm.h"
+#include "FACT_sched.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <pthread.h>
+
+/* Each worker has a deque of runnable tasks. A worker runs the newest
+ * task in its own deque, and when that is empty steals the oldest task
+ * of another worker. Tasks run until they die, park or yield, at which
+ * point they switch back to the worker's loop. A worker with nothing to
+ * run or steal sleeps until a task is pushed.
+ *
+ * Nothing preempts a task. Furlow_run yields every so many backward
+ * jumps and tail calls, and polling for messages yields, so a busy task
+ * can't keep the other tasks on its worker from running.
+ */
+struct FACT_worker {
+  pthread_t id;
+  ucontext_t context;       /* The worker's loop, tasks switch back to it. */
+  pthread_mutex_t lock;     /* Guards the deque.                          */
+  FACT_thread_t *tasks;     /* Ring buffer of runnable tasks.             */
+  size_t head;              /* Index of the oldest task.                  */
+  size_t count;             /* Number of tasks in the deque.              */
+  size_t cap;               /* Room in the ring buffer.                   */
+  bool (*park)(FACT_thread_t); /* Set by a task as it parks.              */
+#ifndef VALGRIND_DEBUG
+  void *gc_thread;                /* The collector's handle for us.       */
+  struct GC_stack_base gc_stack;  /* Our own stack, restored after tasks. */
+#endif
+};
+
+static struct FACT_worker *workers;
+static size_t num_workers; /* Zero until the pool is started, unless set. */
+static size_t next_worker; /* Pushes from outside the pool go round robin. */
+static size_t num_idle;    /* Workers asleep on idle_cond.                  */
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void start_pool (void);
+static void *run_worker (void *);
+static void run_task (struct FACT_worker *, FACT_thread_t);
+static void finish_task (struct FACT_worker *, FACT_thread_t);
+static bool stay_joined (FACT_thread_t);
+static bool stay_runnable (FACT_thread_t);
+static void run_thread (void);
+static void push_task (struct FACT_worker *, FACT_thread_t, bool);
+static FACT_thread_t take_task (struct FACT_worker *, bool);
+static FACT_thread_t find_task (struct FACT_worker *);
+
+void FACT_sched_workers (size_t n) /* Set the number of workers. Must be called before the first spawn. */
+{
+  num_workers = n;
+}
+
+size_t FACT_sched_size (void) /* Get the number of workers, starting the pool if need be. */
+{
+  pthread_once (&pool_once, start_pool);
+  return num_workers;
+}
+
+void FACT_sched_spawn (FACT_thread_t task) /* Start running a new thread on the pool. */
+{
+  pthread_once (&pool_once, start_pool);
+
+  /* The stack is allocated by the collector so that it is scanned while
+   * the task is parked.
+   */
+  task->stack = FACT_malloc (TASK_STACK_SIZE);
+  getcontext (&task->context);
+  task->context.uc_stack.ss_sp = task->stack;
+  task->context.uc_stack.ss_size = TASK_STACK_SIZE;
+  task->context.uc_link = NULL;
+  makecontext (&task->context, run_thread, 0);
+
+  FACT_sched_wake (task);
+}
+
+void FACT_sched_park (bool (*park)(FACT_thread_t)) /* Switch out of the current task. */
+{
+  FACT_thread_t self;
+
+  /* The worker calls park once we've switched out. If it returns false,
+   * the task was woken in the meantime and is run again. Otherwise
+   * whoever wakes it later must call FACT_sched_wake.
+   */
+  self = curr_thread;
+  self->worker->park = park;
+  swapcontext (&self->context, &self->worker->context);
+}
+
+void FACT_sched_yield (void) /* Let the other tasks on the worker run. */
+{
+  struct FACT_worker *self;
+
+  /* The count is read without the lock, at worst we yield for nothing
+   * or run a little longer.
+   */
+  if (curr_thread == NULL || (self = curr_thread->worker) == NULL
+      || __atomic_load_n (&self->count, __ATOMIC_RELAXED) == 0)
+    return;
+  FACT_sched_park (stay_runnable);
+}
+
+void FACT_sched_wake (FACT_thread_t task) /* Push a task to a worker's deque. */
+{
+  struct FACT_worker *dest;
+
+  /* Workers keep the tasks they wake, other threads spread them out. */
+  if (curr_thread != NULL && curr_thread->worker != NULL)
+    dest = curr_thread->worker;
+  else
+    dest = workers + (__atomic_fetch_add (&next_worker, 1, __ATOMIC_RELAXED)
+		      % num_workers);
+  push_task (dest, task, true);
+}
+
+static void start_pool (void) /* Start the worker threads. */
+{
+  size_t i;
+  long cpus;
+  char *env;
+
+  /* The -w flag takes precedence over FACT_WORKERS, and the default is
+   * one worker per CPU.
+   */
+  if (num_workers == 0 && (env = getenv ("FACT_WORKERS")) != NULL)
+    num_workers = strtoul (env, NULL, 10);
+  if (num_workers == 0) {
+    cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    num_workers = (cpus > 0) ? cpus : 1;
+  }
+
+  workers = FACT_malloc (sizeof (struct FACT_worker) * num_workers);
+  for (i = 0; i < num_workers; i++)
+    pthread_mutex_init (&workers[i].lock, NULL);
+  for (i = 0; i < num_workers; i++)
+    pthread_create (&workers[i].id, NULL, run_worker, workers + i);
+}
+
+void FACT_sched_join (FACT_thread_t target) /* Wait for a task to die. */
+{
+  /* Tasks park until the worker that releases the target wakes them.
+   * Everything else sleeps on the target's condition.
+   */
+  if (curr_thread->worker != NULL) {
+    curr_thread->joining = target;
+    while (!__atomic_load_n (&target->finished, __ATOMIC_ACQUIRE))
+      FACT_sched_park (stay_joined);
+    curr_thread->joining = NULL;
+    return;
+  }
+
+  pthread_mutex_lock (&target->join_lock);
+  while (!target->finished)
+    pthread_cond_wait (&target->join_block, &target->join_lock);
+  pthread_mutex_unlock (&target->join_lock);
+}
+
+static void *run_worker (void *arg) /* A worker's loop. */
+{
+  FACT_thread_t task;
+  struct FACT_worker *self;
+
+  self = arg;
+  curr_thread = NULL;
+#ifndef VALGRIND_DEBUG
+  self->gc_thread = GC_get_my_stackbottom (&self->gc_stack);
+#endif
+
+  for (;;) {
+    if ((task = find_task (self)) == NULL) {
+      /* Count ourselves as idle before looking again, so that a task
+       * pushed in between is either found or wakes us.
+       */
+      pthread_mutex_lock (&idle_lock);
+      __atomic_add_fetch (&num_idle, 1, __ATOMIC_SEQ_CST);
+      while ((task = find_task (self)) == NULL)
+	pthread_cond_wait (&idle_cond, &idle_lock);
+      __atomic_sub_fetch (&num_idle, 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock (&idle_lock);
+    }
+    run_task (self, task);
+  }
+
+  return NULL;
+}
+
+static void run_task (struct FACT_worker *self, FACT_thread_t task) /* Run a task until it parks or dies. */
+{
+#ifndef VALGRIND_DEBUG
+  struct GC_stack_base sb;
+
+  /* Tell the collector which stack we're on. */
+  sb.mem_base = (char *) task->stack + TASK_STACK_SIZE;
+  GC_set_stackbottom (self->gc_thread, &sb);
+#endif
+  task->worker = self;
+  curr_thread = task;
+  swapcontext (&self->context, &task->context);
+  curr_thread = NULL;
+#ifndef VALGRIND_DEBUG
+  GC_set_stackbottom (self->gc_thread, &self->gc_stack);
+#endif
+
+  if (task->run_flag == T_DEAD) {
+    /* Nothing runs on the stack anymore. */
+    FACT_free (task->stack);
+    task->stack = NULL;
+    Furlow_remove_thread (task);
+    finish_task (self, task);
+  } else if (!self->park (task))
+    /* Put the task behind everything else, so that a yield lets the
+     * others run first.
+     */
+    push_task (self, task, false);
+}
+
+static void finish_task (struct FACT_worker *self, FACT_thread_t task) /* Wake everything joining a dead task. */
+{
+  FACT_thread_t joiner, next;
+
+  pthread_mutex_lock (&task->join_lock);
+  __atomic_store_n (&task->finished, true, __ATOMIC_RELEASE);
+  joiner = task->joiners;
+  task->joiners = NULL;
+  pthread_cond_broadcast (&task->join_block);
+  pthread_mutex_unlock (&task->join_lock);
+
+  /* A joiner may join again as soon as it runs, so read its link first. */
+  for (; joiner != NULL; joiner = next) {
+    next = joiner->next_joiner;
+    push_task (self, joiner, true);
+  }
+}
+
+static bool stay_joined (FACT_thread_t task) /* Called by the worker once a joining task has parked. */
+{
+  bool res;
+  FACT_thread_t target;
+
+  target = task->joining;
+  pthread_mutex_lock (&target->join_lock);
+  if ((res = !target->finished)) {
+    task->next_joiner = target->joiners;
+    target->joiners = task;
+  }
+  pthread_mutex_unlock (&target->join_lock);
+
+  return res;
+}
+
+static bool stay_runnable (FACT_thread_t task) /* Called by the worker once a yielding task has parked. */
+{
+  return false;
+}
+
+static void run_thread (void) /* Entry point of every task. */
+{
+  Furlow_thread_mask (curr_thread);
+  curr_thread->run_flag = T_DEAD;
+  setcontext (&curr_thread->worker->context);
+}
+
+static void push_task (struct FACT_worker *dest, FACT_thread_t task, bool newest) /* Add a task to either end of a deque. */
+{
+  size_t i, cap;
+  FACT_thread_t *grown;
+
+  pthread_mutex_lock (&dest->lock);
+  if (dest->count == dest->cap) {
+    cap = (dest->cap == 0) ? 16 : dest->cap * 2;
+    grown = FACT_malloc (sizeof (FACT_thread_t) * cap);
+    for (i = 0; i < dest->count; i++)
+      grown[i] = dest->tasks[(dest->head + i) % dest->cap];
+    dest->tasks = grown;
+    dest->head = 0;
+    dest->cap = cap;
+  }
+  if (newest)
+    dest->tasks[(dest->head + dest->count) % dest->cap] = task;
+  else
+    dest->tasks[dest->head = (dest->head + dest->cap - 1) % dest->cap] = task;
+  dest->count++;
+  pthread_mutex_unlock (&dest->lock);
+
+  /* Wake a sleeping worker to run or steal it. */
+  if (__atomic_load_n (&num_idle, __ATOMIC_SEQ_CST) != 0) {
+    pthread_mutex_lock (&idle_lock);
+    pthread_cond_signal (&idle_cond);
+    pthread_mutex_unlock (&idle_lock);
+  }
+}
+
+static FACT_thread_t take_task (struct FACT_worker *from, bool newest) /* Remove a task from either end of a deque. */
+{
+  size_t i;
+  FACT_thread_t res;
+
+  res = NULL;
+  pthread_mutex_lock (&from->lock);
+  if (from->count != 0) {
+    from->count--;
+    if (newest)
+      res = from->tasks[i = (from->head + from->count) % from->cap];
+    else {
+      res = from->tasks[i = from->head];
+      from->head = (from->head + 1) % from->cap;
+    }
+    from->tasks[i] = NULL;
+  }
+  pthread_mutex_unlock (&from->lock);
+
+  return res;
+}
+
+static FACT_thread_t find_task (struct FACT_worker *self) /* Find something to run, stealing if need be. */
+{
+  size_t i, n;
+  FACT_thread_t res;
+
+  if ((res = take_task (self, true)) != NULL)
+    return res;
+
+  /* Start with the worker after us, so thieves don't all pick the same
+   * victim.
+   */
+  n = self - workers;
+  for (i = 1; i < num_workers; i++) {
+    if ((res = take_task (workers + (n + i) % num_workers, false)) != NULL)
+      return res;
+  }
+
+  return NULL;
+}
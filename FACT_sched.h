@@ -0,0 +1,38 @@
+/* This file is part of FACT.
+ *
+ * FACT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FACT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FACT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FACT_SCHED_H_
+#define FACT_SCHED_H_
+
+#include "FACT.h"
+
+/* Threads other than the main one are run as tasks on a pool of worker
+ * pthreads. Each task has its own VM stacks and registers, and a small C
+ * stack that the workers switch to and from.
+ */
+typedef struct FACT_thread *FACT_thread_t;
+
+#define TASK_STACK_SIZE (128 * 1024) /* Size of a task's C stack. */
+
+void FACT_sched_workers (size_t);    /* Set the pool size, 0 for one per CPU. */
+void FACT_sched_spawn (FACT_thread_t); /* Start running a new thread.        */
+void FACT_sched_park (bool (*)(FACT_thread_t)); /* Give up the worker.       */
+void FACT_sched_yield (void);         /* Let the worker's other tasks run.   */
+void FACT_sched_wake (FACT_thread_t); /* Make a parked task runnable again.   */
+void FACT_sched_join (FACT_thread_t); /* Wait for a task to die.             */
+size_t FACT_sched_size (void);        /* Number of workers in the pool.      */
+
+#endif /* FACT_SCHED_H_ */
@@ -20,6 +20,7 @@
 #include "FACT_error.h"
 #include "FACT_types.h"
 #include "FACT_alloc.h"
+#include "FACT_scope.h"
 
 #include <string.h>
 
@@ -27,46 +28,46 @@ static FACT_scope_t *make_scope_array (char *, size_t, size_t *, size_t);
 
 FACT_scope_t FACT_add_scope (FACT_scope_t curr, char *name) /* Add a local scope. */
 {
-  size_t i;
+  return FACT_add_scope_sym (curr, FACT_intern (name));
+}
+
+FACT_scope_t FACT_add_scope_sym (FACT_scope_t curr, char *name) /* Same as FACT_add_scope, name must be a symbol. */
+{
+  size_t i, h;
   int pstat;
   char *hold_name;
   FACT_t new;
   FACT_t *check;
-  FACT_scope_t up;
 
   if (curr->lock_stat != UNLOCKED)
     FACT_throw_error (curr, "variables may not be defined in a locked scope");
+
+  if (name == FACT_SYM ("up")) {
+    /* up is not kept in the table, defining it replaces the up link. */
+    curr->up = FACT_alloc_scope ();
+    curr->up->name = name;
+    return curr->up;
+  }
   
   /* Check if the scope already exists. */
-  check = FACT_find_in_table_nohash (curr->vars, name);
+  h = FACT_sym_hash (name);
+  check = FACT_find_in_table (curr->vars, name, h);
   
   if (check != NULL) { /* It already exists. */
     if (check->type == SCOPE_TYPE) {
-      /* If it does, reset the scope. Do not free any data. */
+      /* If it does, reset the scope. Scopes defined in the old one still
+       * point to it as their up, so it is replaced rather than cleared.
+       */
       FACT_scope_t temp;
 
       temp = check->ap;      
       if (temp->lock_stat == HARD_LOCK)
 	FACT_throw_error (curr, "scope %s already defined and is locked", name);      
       hold_name = temp->name;
-      memset (check->ap, 0, sizeof (struct FACT_scope));
-      
-      /* Reallocate everything. */
-      temp->marked = FACT_malloc_atomic (sizeof (bool));
-      temp->array_size = FACT_malloc_atomic (sizeof (size_t));
-      temp->code = FACT_malloc_atomic (sizeof (size_t));
-      temp->vars = FACT_malloc (sizeof (FACT_table_t));
-      temp->array_up = FACT_malloc (sizeof (FACT_scope_t **));
-      temp->lock_stat = UNLOCKED;
+      temp = FACT_alloc_scope ();
       temp->name = hold_name;
-      
-      /* Add the "up" scope here, unless we are already in the process of doing so. */
-      if (strcmp (name, "up")) {
-	up = FACT_add_scope (temp, "up");
-	memcpy (up, curr, sizeof (struct FACT_scope));
-	up->name = "up";
-      } else
-	curr->up = temp;
+      temp->up = curr;
+      check->ap = temp;
       
       return temp;
     } else /* It's already a number. Through an error. */ 
@@ -76,16 +77,9 @@ FACT_scope_t FACT_add_scope (FACT_scope_t curr, char *name) /* Add a local scope
   new.ap = FACT_alloc_scope ();
   new.type = SCOPE_TYPE;
   ((FACT_scope_t) new.ap)->name = name;
+  ((FACT_scope_t) new.ap)->up = curr;
   FACT_add_to_table (curr->vars, new);
   
-  /* Add the "up" scope here, unless we are already in the process of doing so. */
-  if (strcmp (name, "up")) {
-    up = FACT_add_scope (new.ap, "up");
-    memcpy (up, curr, sizeof (struct FACT_scope));
-    up->name = "up";     
-  } else
-    curr->up = FACT_cast_to_scope (new);
-  
   return new.ap;
 }
 
@@ -102,8 +96,9 @@ void FACT_def_scope (char *args, bool anonymous) /* Define a local or anonymous
   /* Add the local scope or anonymous. */
   push_val.ap = (anonymous
 		 ? FACT_alloc_scope ()
-		 : FACT_add_scope (CURR_THIS, args + 1));
+		 : FACT_add_scope_sym (CURR_THIS, Furlow_sym_arg (args + 1)));
   push_val.type = SCOPE_TYPE;
+  push_val.home = NULL;
 
   if (!dimensions)
     goto end;
@@ -136,14 +131,22 @@ void FACT_def_scope (char *args, bool anonymous) /* Define a local or anonymous
 
 void FACT_get_scope_elem (FACT_scope_t base, char *args) 
 {
-  mpc_t elem_value;
   FACT_t push_val;
-  size_t i;
-  size_t *elems;     /* element of each dimension to access. */
-  size_t dimensions; /* Number of dimensions.                */
+
+  /* Get the element and push it to the stack. */
+  push_val.ap = FACT_index_scope (base, Furlow_reg_val (args[0], NUM_TYPE));
+  push_val.type = SCOPE_TYPE;
+  push_val.home = NULL;
+
+  push_v (push_val);
+}
+
+FACT_scope_t FACT_index_scope (FACT_scope_t base, FACT_num_t index) /* Get an element of a scope array by a FACT index. */
+{
+  mpc_t elem_value;
 
   /* Get the element index. */
-  elem_value[0] = *((FACT_num_t) Furlow_reg_val (args[0], NUM_TYPE))->value;
+  elem_value[0] = *index->value;
 
   if (mpc_is_float (elem_value))
     FACT_throw_error (CURR_THIS, "index value must be a positive integer");
@@ -154,38 +157,45 @@ void FACT_get_scope_elem (FACT_scope_t base, char *args)
       || *base->array_size <= mpc_get_ui (elem_value))
     FACT_throw_error (CURR_THIS, "out of bounds error"); /* should elaborate here. */
 
-  /* Get the element and push it to the stack. */
-  push_val.ap = (*base->array_up)[mpc_get_ui (elem_value)];
-  push_val.type = SCOPE_TYPE;
-
-  push_v (push_val);
+  return (*base->array_up)[mpc_get_ui (elem_value)];
 }
 
-
 void FACT_append_scope (FACT_scope_t op1, FACT_scope_t op2)
 {
-  size_t offset;
+  size_t cap;
+  FACT_scope_t *elems;
   
-  /* Move the op1 to an array if it isn't one already. */
+  /* Move the op1 to an array if it isn't one already, leaving room for
+   * more appends.
+   */
   if (*op1->array_size == 0) {
     *op1->array_size = 1;
-    *op1->array_up = FACT_alloc_scope_array (1);
+    *op1->array_cap = 4;
+    *op1->array_up = FACT_malloc (sizeof (FACT_scope_t) * 4);
+    (*op1->array_up)[0] = FACT_alloc_scope ();
     memcpy ((*op1->array_up)[0], op1, sizeof (struct FACT_scope));
     (*op1->array_up)[0]->array_size = 0;
+    (*op1->array_up)[0]->array_cap = 0;
     (*op1->array_up)[0]->array_up = NULL;
   }
+
+  /* Grow geometrically, like number arrays. */
+  if (*op1->array_size >= *op1->array_cap) {
+    cap = (*op1->array_size < 2) ? 4 : *op1->array_size * 2;
+    elems = FACT_malloc (sizeof (FACT_scope_t) * cap);
+    memcpy (elems, *op1->array_up, sizeof (FACT_scope_t) * *op1->array_size);
+    *op1->array_up = elems;
+    *op1->array_cap = cap;
+  }
   
-  offset = *op1->array_size;
+  (*op1->array_up)[*op1->array_size] = FACT_alloc_scope ();
+  memcpy ((*op1->array_up)[*op1->array_size], op2, sizeof (struct FACT_scope));
   ++*op1->array_size;
-  *op1->array_up = FACT_realloc (*op1->array_up, sizeof (FACT_scope_t) * *op1->array_size);
-
-  (*op1->array_up)[offset] = FACT_alloc_scope ();
-  memcpy ((*op1->array_up)[offset], op2, sizeof (struct FACT_scope));
 }
 
 static FACT_scope_t *make_scope_array (char *name, size_t dims, size_t *dim_sizes, size_t curr_dim)
 {
-  FACT_scope_t *root, up;
+  FACT_scope_t *root;
   size_t i;
 
   if (curr_dim >= dims)
@@ -200,10 +210,7 @@ static FACT_scope_t *make_scope_array (char *name, size_t dims, size_t *dim_size
     if (*root[i]->array_up != NULL)
       *(root[i]->array_size) = dim_sizes[curr_dim + 1];
     
-    /* Add the up scope. */
-    up = FACT_add_scope (root[i], "up");
-    memcpy (up, CURR_THIS, sizeof (struct FACT_scope));
-    root[i]->up = up;
+    root[i]->up = CURR_THIS;
   }
   
   return root;
@@ -17,12 +17,16 @@
 #ifndef FACT_SCOPE_H_
 #define FACT_SCOPE_H_
 
+typedef struct FACT_num *FACT_num_t;
 typedef struct FACT_scope *FACT_scope_t;
 
 FACT_scope_t FACT_get_local_scope (FACT_scope_t, char *);
 FACT_scope_t FACT_add_scope (FACT_scope_t, char *);
+FACT_scope_t FACT_add_scope_sym (FACT_scope_t, char *);
 
 void FACT_def_scope (char *, bool);
+void FACT_get_scope_elem (FACT_scope_t, char *);
+FACT_scope_t FACT_index_scope (FACT_scope_t, FACT_num_t);
 void FACT_append_scope (FACT_scope_t, FACT_scope_t);
 
 #endif /* FACT_SCOPE_H_ */
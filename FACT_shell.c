@@ -25,6 +25,7 @@
 #include "FACT_mpc.h"
 #include "FACT_alloc.h"
 #include "FACT_hash.h"
+#include "FACT_num.h"
 
 #include <ctype.h>
 #include <stdio.h>
@@ -238,7 +239,7 @@ void FACT_shell (void)
 
   /* Set error recovery. */
  reset_error:
-  if (setjmp (recover)) {
+  if (setjmp (curr_thread->recover)) {
     /* Print out the error and a stack trace. */
     fprintf (stderr, "Caught unhandled error: %s\n", curr_thread->curr_err.what);
     while (curr_thread->cstackp - curr_thread->cstack >= 0) {
@@ -331,12 +332,12 @@ static void print_num (FACT_num_t val)
 {
   size_t i;
   
-  if (val->array_up != NULL) {
+  if (val->array_size != 0) {
     printf (" [");
     for (i = 0; i < val->array_size; i++) {
       if (i)
 	printf (", ");
-      print_num (val->array_up[i]);
+      print_num (FACT_get_elem (val, i));
     }
     printf (" ]");
   } else 
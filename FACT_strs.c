@@ -14,11 +14,21 @@
  * along with FACT. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "FACT.h"
+#include "FACT_vm.h"
+#include "FACT_error.h"
 #include "FACT_types.h"
 #include "FACT_alloc.h"
+#include "FACT_num.h"
+#include "FACT_strs.h"
 
+#include <ctype.h>
 #include <string.h>
 
+static const uint8_t *str_bytes (FACT_num_t, size_t *);
+static FACT_num_t make_str (const uint8_t *, size_t);
+static size_t search (const uint8_t *, size_t, const uint8_t *, size_t);
+
 char *FACT_natos (FACT_num_t arr) /* Number array to string. */
 {
   size_t i;
@@ -28,10 +38,14 @@ char *FACT_natos (FACT_num_t arr) /* Number array to string. */
     res = FACT_malloc_atomic (2);
     *res = (char) mpc_get_si (arr->value);
     *(res + 1) = '\0';
+  } else if (arr->pack_type == PACK_BYTES || arr->pack_type == PACK_U8) {
+    res = FACT_malloc_atomic (arr->array_size + 1);
+    memcpy (res, arr->pack, arr->array_size);
+    res[arr->array_size] = '\0';
   } else {
     res = FACT_malloc_atomic (arr->array_size + 1);
     for (i = 0; i < arr->array_size; i++)
-      res[i] = (char) mpc_get_si (arr->array_up[i]->value);
+      res[i] = (char) mpc_get_si (FACT_get_elem (arr, i)->value);
     res[i] = '\0';
   }
 
@@ -40,16 +54,247 @@ char *FACT_natos (FACT_num_t arr) /* Number array to string. */
 
 FACT_num_t FACT_stona (char *str) /* String to number array. */
 {
-  size_t i, len;
+  size_t len;
   FACT_num_t res;
 
+  /* Strings are kept as byte strings until something that isn't a byte
+   * is stored in them.
+   */
   len = strlen (str);
+  res = FACT_make_typed (PACK_BYTES, len);
+  memcpy (res->pack, str, len);
+
+  return res;
+}
+
+/* String processing. Strings may be byte strings, u8 arrays, ordinary
+ * arrays of character codes, or a single character code. Whatever they
+ * are given, these return byte strings.
+ */
+
+FACT_num_t FACT_str_sub (FACT_num_t str, size_t start, size_t len) /* Get part of a string. */
+{
+  size_t n;
+  const uint8_t *bytes;
+
+  bytes = str_bytes (str, &n);
+  if (start > n || len > n - start)
+    FACT_throw_error (CURR_THIS, "out of bounds error");
+
+  return make_str (bytes + start, len);
+}
+
+size_t FACT_str_find (FACT_num_t str, FACT_num_t pat, size_t start) /* Find the first occurrence of pat at or after start. */
+{
+  size_t n, m, res;
+  const uint8_t *bytes, *pbytes;
+
+  bytes = str_bytes (str, &n);
+  pbytes = str_bytes (pat, &m);
+  if (start > n)
+    FACT_throw_error (CURR_THIS, "out of bounds error");
+
+  res = search (bytes + start, n - start, pbytes, m);
+  return (res == FACT_NOT_FOUND) ? res : start + res;
+}
+
+FACT_num_t FACT_str_split (FACT_num_t str, FACT_num_t sep) /* Split a string into an array of strings. */
+{
+  size_t i, n, m, k, at, pieces;
+  const uint8_t *bytes, *sbytes;
+  FACT_num_t res;
+
+  bytes = str_bytes (str, &n);
+  sbytes = str_bytes (sep, &m);
+  if (m == 0)
+    FACT_throw_error (CURR_THIS, "separator must not be empty");
+
+  /* Count the pieces first so the array is only allocated once. */
+  for (pieces = 1, i = 0; (at = search (bytes + i, n - i, sbytes, m)) != FACT_NOT_FOUND; pieces++)
+    i += at + m;
+
+  res = FACT_alloc_num ();
+  res->array_size = pieces;
+  res->array_up = FACT_alloc_num_array (pieces);
+
+  for (k = 0, i = 0; k < pieces; k++) {
+    at = (k + 1 < pieces) ? search (bytes + i, n - i, sbytes, m) : n - i;
+    FACT_set_num (res->array_up[k], make_str (bytes + i, at));
+    i += at + m;
+  }
+
+  return res;
+}
+
+FACT_num_t FACT_str_join (FACT_num_t arr, FACT_num_t sep) /* Join an array of strings, putting sep between them. */
+{
+  size_t i, n, m, len, total;
+  uint8_t *dst;
+  const uint8_t *sbytes;
+  const uint8_t **parts;
+  size_t *lens;
+  FACT_num_t res;
+
+  if (arr->array_size == 0) {
+    sbytes = str_bytes (arr, &len);
+    return make_str (sbytes, len);
+  }
+
+  n = arr->array_size;
+  sbytes = str_bytes (sep, &m);
+  parts = FACT_malloc (sizeof (uint8_t *) * n);
+  lens = FACT_malloc_atomic (sizeof (size_t) * n);
+
+  for (i = 0, total = m * (n - 1); i < n; i++) {
+    parts[i] = str_bytes (FACT_get_elem (arr, i), lens + i);
+    total += lens[i];
+  }
+
+  res = make_str (NULL, total);
+  for (i = 0, dst = res->pack; i < n; i++) {
+    if (i != 0) {
+      memcpy (dst, sbytes, m);
+      dst += m;
+    }
+    memcpy (dst, parts[i], lens[i]);
+    dst += lens[i];
+  }
+
+  FACT_free (parts);
+  FACT_free (lens);
+  return res;
+}
+
+FACT_num_t FACT_str_replace (FACT_num_t str, FACT_num_t old, FACT_num_t new) /* Replace every occurrence of old with new. */
+{
+  size_t i, n, m, r, at, count;
+  uint8_t *dst;
+  const uint8_t *bytes, *obytes, *nbytes;
+  FACT_num_t res;
+
+  bytes = str_bytes (str, &n);
+  obytes = str_bytes (old, &m);
+  nbytes = str_bytes (new, &r);
+  if (m == 0)
+    FACT_throw_error (CURR_THIS, "string to replace must not be empty");
+
+  for (count = 0, i = 0; (at = search (bytes + i, n - i, obytes, m)) != FACT_NOT_FOUND; count++)
+    i += at + m;
+
+  res = make_str (NULL, n - count * m + count * r);
+  for (i = 0, dst = res->pack; count--; i += at + m) {
+    at = search (bytes + i, n - i, obytes, m);
+    memcpy (dst, bytes + i, at);
+    memcpy (dst + at, nbytes, r);
+    dst += at + r;
+  }
+  memcpy (dst, bytes + i, n - i);
+
+  return res;
+}
+
+FACT_num_t FACT_str_trim (FACT_num_t str) /* Remove leading and trailing white space. */
+{
+  size_t n, start;
+  const uint8_t *bytes;
+
+  bytes = str_bytes (str, &n);
+  for (start = 0; start < n && isspace (bytes[start]); start++)
+    ;
+  while (n > start && isspace (bytes[n - 1]))
+    n--;
+
+  return make_str (bytes + start, n - start);
+}
+
+FACT_num_t FACT_str_parse (FACT_num_t str) /* Convert a string holding a decimal or hexadecimal number to its value. */
+{
+  size_t i, n, digits, dots;
+  char *text;
+  FACT_num_t res;
+
+  /* Surrounding white space is allowed. */
+  text = FACT_natos (FACT_str_trim (str));
+  n = strlen (text);
+
+  /* Check the syntax here, as mpc_set_str can't report errors. */
+  i = (text[0] == '-') ? 1 : 0;
+  if (text[i] == '0' && tolower (text[i + 1]) == 'x') {
+    for (digits = 0, i += 2; isxdigit (text[i]); i++)
+      digits++;
+    dots = 0;
+  } else {
+    for (digits = dots = 0; isdigit (text[i]) || text[i] == '.'; i++) {
+      if (text[i] == '.')
+	dots++;
+      else
+	digits++;
+    }
+  }
+  if (i != n || digits == 0 || dots > 1)
+    FACT_throw_error (CURR_THIS, "could not parse \"%s\" as a number", text);
+
   res = FACT_alloc_num ();
+  if (tolower (text[(text[0] == '-') + 1]) == 'x') {
+    /* mpz_set_str does not take a 0x prefix for base 16. */
+    i = (text[0] == '-');
+    memmove (text + i, text + i + 2, n - i - 1);
+    mpc_set_str (res->value, text, 16);
+  } else
+    mpc_set_str (res->value, text, 10);
 
-  res->array_size = len;
-  res->array_up = FACT_alloc_num_array (len);
-  for (i = 0; i < len; i++)
-    mpc_set_si (res->array_up[i]->value, *(str++));
+  FACT_free (text);
+  return res;
+}
+
+static const uint8_t *str_bytes (FACT_num_t str, size_t *len) /* Get the bytes of a string. */
+{
+  uint8_t *res;
+  size_t i;
+
+  if (str->pack_type == PACK_BYTES || str->pack_type == PACK_U8) {
+    *len = str->array_size;
+    return str->pack;
+  }
+
+  if (str->array_size == 0) {
+    /* A number is a string of one character. */
+    *len = 1;
+    res = FACT_malloc_atomic (1);
+    *res = (uint8_t) mpc_get_si (str->value);
+    return res;
+  }
+
+  *len = str->array_size;
+  res = FACT_malloc_atomic (str->array_size);
+  for (i = 0; i < str->array_size; i++)
+    res[i] = (uint8_t) mpc_get_si (FACT_get_elem (str, i)->value);
+  return res;
+}
+
+static FACT_num_t make_str (const uint8_t *bytes, size_t len) /* Make a byte string, copying bytes if it isn't NULL. */
+{
+  FACT_num_t res;
 
+  res = FACT_make_typed (PACK_BYTES, len);
+  if (bytes != NULL)
+    memcpy (res->pack, bytes, len);
   return res;
 }
+
+static size_t search (const uint8_t *hay, size_t n, const uint8_t *pat, size_t m) /* Find pat in hay. */
+{
+  size_t i;
+  const uint8_t *p;
+
+  if (m == 0)
+    return 0;
+  
+  /* memchr skips to each possible start much faster than a byte loop. */
+  for (i = 0; m <= n - i && (p = memchr (hay + i, pat[0], n - i - m + 1)) != NULL; i = p - hay + 1) {
+    if (memcmp (p + 1, pat + 1, m - 1) == 0)
+      return p - hay;
+  }
+
+  return FACT_NOT_FOUND;
+}
@@ -23,4 +23,14 @@
 char *FACT_natos (FACT_num_t);  /* Number array to string. */
 FACT_num_t FACT_stona (char *); /* String to number array. */
 
+/* String processing functions.                            */
+#define FACT_NOT_FOUND ((size_t) -1)
+FACT_num_t FACT_str_sub (FACT_num_t, size_t, size_t);
+size_t FACT_str_find (FACT_num_t, FACT_num_t, size_t);
+FACT_num_t FACT_str_split (FACT_num_t, FACT_num_t);
+FACT_num_t FACT_str_join (FACT_num_t, FACT_num_t);
+FACT_num_t FACT_str_replace (FACT_num_t, FACT_num_t, FACT_num_t);
+FACT_num_t FACT_str_trim (FACT_num_t);
+FACT_num_t FACT_str_parse (FACT_num_t);
+
 #endif /* FACT_STRS_H_ */
@@ -21,77 +21,530 @@
 #include "FACT_error.h"
 #include "FACT_mpc.h"
 #include "FACT_num.h"
+#include "FACT_hash.h"
+#include "FACT_sched.h"
 
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
 #include <pthread.h>
 
-void FACT_send_message (FACT_num_t msg, size_t dest) /* Add a message to a thread's queue. */
+/* Each thread's message queue is an intrusive multi-producer, single-
+ * consumer list. msg_tail always points to a dummy node whose successor
+ * is the next message. Senders link a node in by swapping msg_head, so a
+ * send is a single atomic exchange and never waits for other senders or
+ * the receiver. Only the owning thread moves msg_tail. The mutex and the
+ * condition are used solely to sleep when the queue is empty.
+ */
+
+void FACT_init_messages (FACT_thread_t thread) /* Initialize a thread's queue. */
+{
+  thread->msg_head = thread->msg_tail = FACT_malloc (sizeof (struct FACT_thread_queue));
+  thread->msg_head->msg.ap = NULL;
+  thread->msg_head->next = NULL;
+  thread->num_messages = 0;
+  thread->msg_waiting = false;
+  pthread_mutex_init (&thread->queue_lock, NULL);
+  pthread_cond_init (&thread->msg_block, NULL);
+}
+
+static void push_message (FACT_thread_t dest, struct FACT_thread_queue *node)
+{
+  struct FACT_thread_queue *prev;
+
+  node->next = NULL;
+  /* Count the message first, so num_messages never undercounts. */
+  __atomic_add_fetch (&dest->num_messages, 1, __ATOMIC_SEQ_CST);
+  prev = __atomic_exchange_n (&dest->msg_head, node, __ATOMIC_SEQ_CST);
+  __atomic_store_n (&prev->next, node, __ATOMIC_RELEASE);
+
+  /* Wake the receiver if it is, or is about to be, asleep. Clearing the
+   * flag makes sure only one sender wakes a parked task.
+   */
+  if (__atomic_exchange_n (&dest->msg_waiting, false, __ATOMIC_SEQ_CST)) {
+    if (dest->msg_park)
+      FACT_sched_wake (dest);
+    else {
+      pthread_mutex_lock (&dest->queue_lock);
+      pthread_cond_signal (&dest->msg_block);
+      pthread_mutex_unlock (&dest->queue_lock);
+    }
+  }
+}
+
+static bool stay_parked (FACT_thread_t thread) /* Called by the worker once a receiving task has parked. */
+{
+  thread->msg_park = true;
+  __atomic_store_n (&thread->msg_waiting, true, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&thread->msg_head, __ATOMIC_SEQ_CST) == thread->msg_tail)
+    return true;
+
+  /* A message came in while we were parking. If a sender already took
+   * the flag, it will wake us. Otherwise, we take it back and run again.
+   */
+  return !__atomic_exchange_n (&thread->msg_waiting, false, __ATOMIC_SEQ_CST);
+}
+
+static struct FACT_thread_queue *peek_message (void) /* The next message, if there is one. */
+{
+  return __atomic_load_n (&curr_thread->msg_tail->next, __ATOMIC_ACQUIRE);
+}
+
+static struct FACT_thread_queue *pop_message (void)
+{
+  struct FACT_thread_queue *tail, *next;
+
+  tail = curr_thread->msg_tail;
+  next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+  if (next == NULL)
+    return NULL;
+
+  /* next becomes the new dummy. The caller takes its message. */
+  curr_thread->msg_tail = next;
+  __atomic_sub_fetch (&curr_thread->num_messages, 1, __ATOMIC_SEQ_CST);
+  return next;
+}
+
+static bool wait_message (const struct timespec *deadline) /* Wait until the queue isn't empty. */
+{
+  int err;
+
+  for (;;) {
+    if (peek_message () != NULL)
+      return true;
+
+    /* A sender has swapped msg_head but not yet linked its node. */
+    if (__atomic_load_n (&curr_thread->msg_head, __ATOMIC_SEQ_CST) != curr_thread->msg_tail) {
+      sched_yield ();
+      continue;
+    }
+
+    /* Tasks give up their worker rather than blocking it, except for a
+     * timed wait, which has no timer to wake it.
+     */
+    if (curr_thread->worker != NULL && deadline == NULL) {
+      FACT_sched_park (stay_parked);
+      continue;
+    }
+
+    err = 0;
+    pthread_mutex_lock (&curr_thread->queue_lock);
+    curr_thread->msg_park = false;
+    __atomic_store_n (&curr_thread->msg_waiting, true, __ATOMIC_SEQ_CST);
+    /* Check again now that senders can see the flag. */
+    if (__atomic_load_n (&curr_thread->msg_head, __ATOMIC_SEQ_CST) == curr_thread->msg_tail) {
+      if (deadline == NULL)
+	pthread_cond_wait (&curr_thread->msg_block, &curr_thread->queue_lock);
+      else
+	err = pthread_cond_timedwait (&curr_thread->msg_block, &curr_thread->queue_lock, deadline);
+    }
+    __atomic_store_n (&curr_thread->msg_waiting, false, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock (&curr_thread->queue_lock);
+
+    if (err == ETIMEDOUT)
+      return peek_message () != NULL;
+  }
+}
+
+static void *take_message (struct FACT_thread_queue *node) /* Take a message out of its node. */
+{
+  void *res;
+  size_t n;
+
+  res = node->msg.ap;
+  /* The node lives on as the dummy, so drop its reference. */
+  node->msg.ap = NULL;
+
+  if (node->msg.type == NUM_TYPE && !((FACT_num_t) res)->locked)
+    return res; /* A private copy, hand it over. */
+
+  /* The value is shared with the sender, and must not be renamed. Make
+   * a view of it instead, the same way scopes are copied with memcpy.
+   */
+  n = ((node->msg.type == NUM_TYPE)
+       ? sizeof (struct FACT_num)
+       : sizeof (struct FACT_scope));
+  return memcpy (FACT_malloc (n), res, n);
+}
+
+static FACT_scope_t message_scope (struct FACT_thread_queue *node)
+{
+  char *name;
+  FACT_t message;
+  FACT_num_t sender;
+  FACT_scope_t msg_holder;
+
+  /* Create a scope to represent the message. */
+  msg_holder = FACT_alloc_scope ();
+  sender = FACT_add_num_sym (msg_holder, FACT_SYM ("sender"));
+  mpc_set_ui (sender->value, node->sender_id);
+
+  message.type = node->msg.type;
+  message.home = NULL;
+  message.ap = take_message (node);
+  name = FACT_SYM ("message");
+  if (message.type == NUM_TYPE)
+    FACT_cast_to_num (message)->name = name;
+  else
+    FACT_cast_to_scope (message)->name = name;
+  /* Defined like any other local, so a constant named message is shadowed. */
+  FACT_add_to_table (msg_holder->vars, message);
+
+  return msg_holder;
+}
+
+static FACT_t share_value (FACT_t val, const char *err) /* Get a value that another thread can use. */
+{
+  FACT_t res;
+
+  /* Locked values can't change, so they are passed by reference. Other
+   * numbers are copied, and other scopes can't be shared at all.
+   */
+  res.type = val.type;
+  res.home = NULL;
+  if (val.type == SCOPE_TYPE) {
+    if (FACT_cast_to_scope (val)->lock_stat == UNLOCKED)
+      FACT_throw_error (CURR_THIS, "%s", err);
+    res.ap = val.ap;
+  } else if (FACT_cast_to_num (val)->locked)
+    res.ap = val.ap;
+  else {
+    res.ap = FACT_alloc_num ();
+    FACT_set_num (res.ap, val.ap);
+  }
+
+  return res;
+}
+
+void FACT_send_message (FACT_t msg, size_t dest) /* Add a message to a thread's queue. */
 {
   FACT_thread_t curr;
-  struct FACT_thread_queue *last;
+  struct FACT_thread_queue *node;
 
   /* Find the thread number "dest". If it doesn't exist or is dead,
    * throw an error.
    */
-  for (curr = threads; curr != NULL; curr = curr->next) {
-    if (curr->thread_num == dest)
-      goto found_thread;
-  }
-  /* The thread does not exist, throw an error. */
-  FACT_throw_error (CURR_THIS, "no thread number %zu exists", dest);
-
- found_thread: /* We've found the thread. */
-  if (curr->run_flag == T_DEAD) /* The thread has terminated, throw an error. */
-    FACT_throw_error (CURR_THIS, "thread number %zu is dead", dest);
-
-  /* Gain control of the message queue and add the message. */
-  pthread_mutex_lock (&curr->queue_lock);
-
-  if (curr->root_message == NULL) {
-    /* Add the root message. */
-    curr->root_message = FACT_malloc (sizeof (struct FACT_thread_queue));
-    curr->root_message->sender_id = curr_thread->thread_num;
-    curr->root_message->msg = FACT_alloc_num ();
-    curr->root_message->next = NULL;
-    FACT_set_num (curr->root_message->msg, msg);
-    pthread_cond_broadcast(&curr->msg_block);
-  } else {
-    /* Find the next open spot in the linked list. */
-    for (last = curr->root_message; last->next != NULL; last = last->next)
-      ;
-    last->next = FACT_malloc (sizeof (struct FACT_thread_queue));
-    last = last->next;
-    last->sender_id = curr_thread->thread_num;
-    last->msg = FACT_alloc_num ();
-    FACT_set_num (last->msg, msg);
+  if ((curr = Furlow_get_thread (dest)) == NULL) {
+    if (Furlow_was_thread (dest))
+      FACT_throw_error (CURR_THIS, "thread number %zu is dead", dest);
+    FACT_throw_error (CURR_THIS, "no thread number %zu exists", dest);
   }
 
-  curr->num_messages++;  
-  pthread_mutex_unlock (&curr->queue_lock);
+  node = FACT_malloc (sizeof (struct FACT_thread_queue));
+  node->sender_id = curr_thread->thread_num;
+  node->msg = share_value (msg, "only locked scopes can be sent");
+  push_message (curr, node);
 }
 
 FACT_scope_t FACT_get_next_message (void) /* Pop the current thread's message queue. */
 {
-  FACT_num_t sender, message;
-  FACT_scope_t msg_holder;
-  
-  pthread_mutex_lock (&curr_thread->queue_lock);
-  
   /* If there are no messages, block. */
-  while (curr_thread->num_messages == 0)
-    pthread_cond_wait (&curr_thread->msg_block, &curr_thread->queue_lock);
+  wait_message (NULL);
+  return message_scope (pop_message ());
+}
+
+FACT_scope_t FACT_try_next_message (void) /* Pop the queue without blocking. */
+{
+  struct FACT_thread_queue *node;
+
+  /* A task polling an empty queue lets the sender run. */
+  if ((node = pop_message ()) == NULL) {
+    FACT_sched_yield ();
+    return NULL;
+  }
+  return message_scope (node);
+}
+
+FACT_scope_t FACT_wait_next_message (double ms) /* Pop the queue, waiting at most ms. */
+{
+  struct timespec deadline;
+
+  if (ms <= 0)
+    return FACT_try_next_message ();
   
-  /* Create a scope to represent the message. */
-  msg_holder = FACT_alloc_scope ();
-  sender = FACT_add_num (msg_holder, "sender");
-  message = FACT_add_num (msg_holder, "message");
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += (time_t) (ms / 1000);
+  deadline.tv_nsec += (long) (fmod (ms, 1000) * 1000000);
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
 
-  mpc_set_ui (sender->value, curr_thread->root_message->sender_id);
-  FACT_set_num (message, curr_thread->root_message->msg);
+  return wait_message (&deadline) ? message_scope (pop_message ()) : NULL;
+}
 
-  /* Remove the element from the queue and return. */
-  curr_thread->root_message = curr_thread->root_message->next;
-  curr_thread->num_messages--;
-  pthread_mutex_unlock (&curr_thread->queue_lock);
-  return msg_holder;
+FACT_num_t FACT_get_messages (size_t max) /* Pop up to max messages at once. */
+{
+  size_t i, avail;
+  FACT_num_t res, pair;
+  struct FACT_thread_queue *node;
+
+  /* Block for the first message only. */
+  wait_message (NULL);
+  avail = __atomic_load_n (&curr_thread->num_messages, __ATOMIC_SEQ_CST);
+  if (max > avail)
+    max = avail;
+
+  /* Return an array of [sender, message] pairs. A scope can't be put in
+   * the array, so the batch stops short of the first one, and is empty
+   * if it is next.
+   */
+  res = FACT_alloc_num ();
+  res->array_up = FACT_alloc_num_array (max ? max : 1);
+  for (i = 0; i < max; i++) {
+    node = peek_message ();
+    if (node == NULL || node->msg.type != NUM_TYPE)
+      break;
+    pop_message ();
+    pair = res->array_up[i];
+    pair->array_size = 2;
+    pair->array_up = FACT_alloc_num_array (2);
+    mpc_set_ui (pair->array_up[0]->value, node->sender_id);
+    pair->array_up[1] = take_message (node);
+  }
+  res->array_size = i;
+
+  return res;
+}
+
+size_t FACT_count_messages (void) /* Number of messages waiting. */
+{
+  size_t res;
+
+  /* Yield like FACT_try_next_message. */
+  if ((res = __atomic_load_n (&curr_thread->num_messages, __ATOMIC_SEQ_CST)) == 0)
+    FACT_sched_yield ();
+  return res;
+}
+
+/* pmap and preduce split an array into a few chunks per worker, and run
+ * each chunk on a task of its own with Furlow_call. The caller waits for
+ * every chunk before it looks at the results or rethrows an error, so
+ * nothing is left running on the array once they return.
+ */
+#define CHUNKS_PER_WORKER 4
+
+struct chunk {
+  FACT_scope_t func;  /* Function to call on each element.     */
+  FACT_num_t src;     /* Array being mapped or reduced.        */
+  FACT_num_t dest;    /* Results of pmap.                      */
+  size_t start, end;  /* Range of src covered by the chunk.    */
+  FACT_t acc;         /* Running value of preduce.             */
+};
+
+static void map_chunk (void *arg) /* Entry of a pmap task. */
+{
+  size_t i;
+  FACT_t elem, res;
+  struct chunk *work;
+
+  work = arg;
+  elem.type = NUM_TYPE;
+  for (i = work->start; i < work->end; i++) {
+    elem.ap = FACT_get_elem (work->src, i);
+    res = Furlow_call (work->func, &elem, 1);
+    if (res.type != NUM_TYPE)
+      FACT_throw_error (CURR_THIS, "pmap function must return a number");
+    FACT_set_num (work->dest->array_up[i], res.ap);
+  }
+}
+
+static void reduce_chunk (void *arg) /* Entry of a preduce task. */
+{
+  size_t i;
+  FACT_t args[2];
+  struct chunk *work;
+
+  work = arg;
+  args[0] = work->acc;
+  args[1].type = NUM_TYPE;
+  for (i = work->start; i < work->end; i++) {
+    args[1].ap = FACT_get_elem (work->src, i);
+    args[0] = Furlow_call (work->func, args, 2);
+  }
+  work->acc = args[0];
+}
+
+static struct chunk *split_array (FACT_scope_t func, FACT_num_t src, size_t *count) /* Divide an array into chunks. */
+{
+  size_t i, n;
+  struct chunk *res;
+
+  n = FACT_sched_size () * CHUNKS_PER_WORKER;
+  if (n > src->array_size)
+    n = src->array_size;
+
+  res = FACT_malloc (sizeof (struct chunk) * (n ? n : 1));
+  for (i = 0; i < n; i++) {
+    res[i].func = func;
+    res[i].src = src;
+    res[i].dest = NULL;
+    res[i].start = src->array_size * i / n;
+    res[i].end = src->array_size * (i + 1) / n;
+  }
+
+  *count = n;
+  return res;
+}
+
+static void run_chunks (struct chunk *chunks, size_t count, void (*entry)(void *)) /* Run every chunk and wait. */
+{
+  size_t i;
+  FACT_thread_t *tasks;
+
+  tasks = FACT_malloc (sizeof (FACT_thread_t) * (count ? count : 1));
+  for (i = 0; i < count; i++) {
+    tasks[i] = Furlow_new_thread (0);
+    tasks[i]->entry = entry;
+    tasks[i]->entry_arg = chunks + i;
+    FACT_sched_spawn (tasks[i]);
+  }
+
+  for (i = 0; i < count; i++)
+    FACT_sched_join (tasks[i]);
+
+  /* Report the first error in the array's order. */
+  for (i = 0; i < count; i++) {
+    if (tasks[i]->failed)
+      FACT_throw_error (CURR_THIS, "%s", tasks[i]->curr_err.what);
+  }
 }
 
+FACT_num_t FACT_pmap (FACT_scope_t func, FACT_num_t src) /* Call func on every element of an array in parallel. */
+{
+  size_t i, count;
+  FACT_num_t res;
+  struct chunk *chunks;
+
+  res = FACT_alloc_num ();
+  if (src->array_size == 0)
+    return res;
+  res->array_size = src->array_size;
+  res->array_up = FACT_alloc_num_array (src->array_size);
+
+  chunks = split_array (func, src, &count);
+  for (i = 0; i < count; i++)
+    chunks[i].dest = res;
+  run_chunks (chunks, count, map_chunk);
+
+  return res;
+}
+
+FACT_t FACT_preduce (FACT_scope_t func, FACT_t init, FACT_num_t src) /* Fold an array with func in parallel. */
+{
+  size_t i, count;
+  FACT_t args[2];
+  struct chunk *chunks;
+
+  /* Only the first chunk starts from init, the rest start from their
+   * first element. So func has to be associative, but init doesn't have
+   * to be its identity.
+   */
+  chunks = split_array (func, src, &count);
+  if (count == 0)
+    return init;
+  chunks[0].acc = init;
+  for (i = 1; i < count; i++) {
+    chunks[i].acc.type = NUM_TYPE;
+    chunks[i].acc.ap = FACT_get_elem (src, chunks[i].start++);
+  }
+  run_chunks (chunks, count, reduce_chunk);
+
+  /* Combine the chunks in order. */
+  args[0] = chunks[0].acc;
+  for (i = 1; i < count; i++) {
+    args[1] = chunks[i].acc;
+    args[0] = Furlow_call (func, args, 2);
+  }
+
+  return args[0];
+}
+
+/* spawn starts a joinable task that calls a function, and await takes
+ * its result straight from the dead task. No messages are involved.
+ */
+struct spawn_call {
+  FACT_scope_t func; /* Function to call.   */
+  FACT_t *argv;      /* Its arguments.      */
+  size_t argc;       /* Number of arguments. */
+};
+
+static void run_spawn (void *arg) /* Entry of a spawned task. */
+{
+  struct spawn_call *call;
+
+  call = arg;
+  curr_thread->result = Furlow_call (call->func, call->argv, call->argc);
+}
+
+size_t FACT_spawn (FACT_scope_t func, FACT_t args, bool spread) /* Call a function on a new thread. */
+{
+  size_t i;
+  FACT_t elem;
+  FACT_thread_t task;
+  struct spawn_call *call;
+
+  /* If spread is set, args is the list of arguments. Otherwise it is the
+   * only argument, whatever it is, so strings are passed whole.
+   */
+  call = FACT_malloc (sizeof (struct spawn_call));
+  call->func = func;
+  if (spread) {
+    if (args.type != NUM_TYPE)
+      FACT_throw_error (CURR_THIS, "argument list must be an array");
+    call->argc = FACT_cast_to_num (args)->array_size;
+    call->argv = FACT_malloc (sizeof (FACT_t) * (call->argc ? call->argc : 1));
+    elem.type = NUM_TYPE;
+    for (i = 0; i < call->argc; i++) {
+      elem.ap = FACT_get_elem (args.ap, i);
+      call->argv[i] = share_value (elem, NULL);
+    }
+  } else {
+    call->argc = 1;
+    call->argv = FACT_malloc (sizeof (FACT_t));
+    call->argv[0] = share_value (args, "only locked scopes can be passed to a thread");
+  }
+
+  task = Furlow_new_thread (0);
+  task->entry = run_spawn;
+  task->entry_arg = call;
+  task->joinable = true;
+  task->result.type = UNSET_TYPE;
+  FACT_sched_spawn (task);
+
+  return task->thread_num;
+}
+
+FACT_t FACT_await (size_t id) /* Wait for a spawned thread and get its result. */
+{
+  FACT_t res;
+  FACT_thread_t task;
+
+  if (id == curr_thread->thread_num)
+    FACT_throw_error (CURR_THIS, "a thread cannot await itself");
+  if ((task = Furlow_find_thread (id)) == NULL) {
+    if (Furlow_was_thread (id))
+      FACT_throw_error (CURR_THIS, "thread number %zu is dead", id);
+    FACT_throw_error (CURR_THIS, "no thread number %zu exists", id);
+  }
+  if (!task->joinable)
+    FACT_throw_error (CURR_THIS, "thread number %zu was not spawned", id);
+  if (__atomic_exchange_n (&task->joined, true, __ATOMIC_SEQ_CST))
+    FACT_throw_error (CURR_THIS, "thread number %zu is already awaited", id);
+
+  FACT_sched_join (task);
+  Furlow_forget_thread (task);
+
+  /* Errors are thrown again in the thread that awaits. */
+  if (task->failed)
+    FACT_throw_error (CURR_THIS, "%s", task->curr_err.what);
+
+  res = task->result;
+  if (res.type == UNSET_TYPE) {
+    res.type = NUM_TYPE;
+    res.ap = FACT_alloc_num ();
+  }
+  return res;
+}
@@ -20,8 +20,20 @@
 #include "FACT.h"
 
 typedef struct FACT_num *FACT_num_t;
+typedef struct FACT_thread *FACT_thread_t;
 
-void FACT_send_message (FACT_num_t, size_t); /* Send a message. */
+void FACT_init_messages (FACT_thread_t); /* Set up an empty queue. */
+void FACT_send_message (FACT_t, size_t); /* Send a message. */
 FACT_scope_t FACT_get_next_message (void); /* Recieve a message. */
+FACT_scope_t FACT_try_next_message (void); /* NULL if there are none. */
+FACT_scope_t FACT_wait_next_message (double); /* NULL on timeout. */
+FACT_num_t FACT_get_messages (size_t); /* Recieve a batch. */
+size_t FACT_count_messages (void);
+
+FACT_num_t FACT_pmap (FACT_scope_t, FACT_num_t); /* Map an array in parallel. */
+FACT_t FACT_preduce (FACT_scope_t, FACT_t, FACT_num_t); /* Reduce an array in parallel. */
+
+size_t FACT_spawn (FACT_scope_t, FACT_t, bool); /* Call a function on a new thread. */
+FACT_t FACT_await (size_t); /* Get the result of a spawned thread. */
 
 #endif /* FACT_THREADS_H_ */
@@ -36,17 +36,35 @@ typedef struct _var_table FACT_table_t;
  */
 typedef struct {
   void *ap;       /* Casted num or scope pointer.  */
-  FACT_table_t *home; /* For unset types. */
+  FACT_table_t *home; /* Table the variable is in, or NULL. */
   FACT_type type; /* Type of the passed data.      */
 } FACT_t;
 
+/* Element types of typed number arrays. The elements of a typed array
+ * are kept in a native buffer instead of array_up.
+ */
+typedef enum {
+  PACK_NONE = 0, /* Not typed, elements are in array_up. */
+  PACK_I64,      /* Signed 64 bit integers.              */
+  PACK_F64,      /* Double precision floats.             */
+  PACK_U8,       /* Unsigned bytes.                      */
+  PACK_BYTES,    /* Bytes of a string. Storing anything
+		  * but a byte promotes it to PACK_NONE. */
+} FACT_pack_t;
+
 /* The FACT_num structure expresses real numbers. */
 typedef struct FACT_num {
   bool locked;                /* Locked variables are immutable.      */
   mpc_t value;                /* value held by the variable.          */
   char *name;                 /* Name of the variable.                */
   size_t array_size;          /* Size of the current dimension.       */
+  size_t array_cap;           /* Room for appends, if above the size. */
   struct FACT_num **array_up; /* Points to the next dimension.        */
+  FACT_pack_t pack_type;      /* Element type, if the array is typed. */
+  void *pack;                 /* Elements of a typed array.           */
+  struct FACT_num *owner;     /* Typed array an element was boxed in. */
+  size_t index;               /* Index of the element in the owner.   */
+  size_t hash;                /* Cached hash of a byte string, or 0.  */
 } *FACT_num_t;
 
 /* The FACT_scope structure expresses scopes and functions. */ 
@@ -58,6 +76,7 @@ typedef struct FACT_scope {
     SOFT_LOCK,                   /* Most lock restrictions apply.          */
   } lock_stat;
   size_t *array_size;            /* Size of the current dimension.         */
+  size_t *array_cap;             /* Room for appends, if above the size.   */
   size_t *code;                  /* Location of the function's body.       */
   char *name;                    /* Declared name of the scope.            */
   FACT_table_t *vars;            /* Table of declared variables.           */
@@ -65,6 +84,7 @@ typedef struct FACT_scope {
   struct FACT_scope *up;         /* Points to the next scope up.           */
   struct FACT_scope *caller;     /* Points to the calling function.        */
   struct FACT_scope ***array_up; /* The next dimension up.                 */
+  struct FACT_dict *dict;        /* Entries, if the scope is a dictionary. */
   struct FACT_va_list {          /* Variadic argument list.                */
     FACT_t var;                  /* Node value.                            */
     struct FACT_va_list *next;   /* Next argument in the list.             */
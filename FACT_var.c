@@ -19,6 +19,7 @@
 #include "FACT_hash.h"
 #include "FACT_vm.h"
 #include "FACT_error.h"
+#include "FACT_var.h"
 
 #include <string.h>
 
@@ -39,43 +40,146 @@ FACT_t *FACT_get_global (FACT_scope_t env, char *name)
   return FACT_find_in_table (&Furlow_globals, name, h);    
 }
 
-void FACT_get_var (char *name) /* Search all relevent scopes for a variable and push it to the stack. */
+static inline void fill_icache (struct FACT_icache *ic, char *name)
+{
+  if (ic->name != name) {
+    /* First use of the cache, or the instruction was replaced. */
+    ic->name = name;
+    ic->hash = FACT_sym_hash (name);
+    ic->shape = NULL;
+    ic->table = NULL;
+  }
+}
+
+/* Same as FACT_get_global, but use the inline cache ic. */
+FACT_t *FACT_get_global_cached (FACT_scope_t env, char *name, struct FACT_icache *ic)
+{
+  long i;
+  FACT_t *r;
+  size_t d;
+  uint64_t bit;
+  FACT_scope_t start;
+
+  start = env;
+  if (ic->name != name) {
+    fill_icache (ic, name);
+    goto miss;
+  }
+  bit = FACT_bloom_bit (ic->hash);
+
+  /* None of the scopes passed over may have gained the name. */
+  for (d = 0; d < ic->depth; d++, env = env->up) {
+    if (env == NULL || env->lock_stat != UNLOCKED)
+      goto miss;
+    if ((env->vars->bloom & bit)
+	&& FACT_find_in_table (env->vars, name, ic->hash) != NULL)
+      goto miss;
+  }
+
+  if (ic->shape != NULL) {
+    /* The name was found in a scope in shape mode. */
+    if (env == NULL
+	|| env->lock_stat != UNLOCKED
+	|| env->vars->shape != ic->shape)
+      goto miss;
+    return env->vars->slots + ic->slot;
+  } else if (ic->table == &Furlow_globals) {
+    /* The search went through to the globals table last time. */
+    if ((env != NULL && env->lock_stat == UNLOCKED)
+	|| ic->version != Furlow_globals.version)
+      goto miss;
+  } else if (env == NULL
+	     || env->lock_stat != UNLOCKED
+	     || env->vars != ic->table
+	     || ic->version != ic->table->version)
+    goto miss;
+
+  return ic->hit;
+
+ miss:
+  /* Do a full search and refill the cache. */
+  bit = FACT_bloom_bit (ic->hash);
+  for (d = 0, env = start;
+       env != NULL && env->lock_stat == UNLOCKED;
+       d++, env = env->up) {
+    if (!(env->vars->bloom & bit))
+      continue;
+    if (env->vars->buckets == NULL) {
+      if ((i = FACT_shape_slot (env->vars->shape, name, ic->hash)) != -1) {
+	ic->depth = d;
+	ic->shape = env->vars->shape;
+	ic->slot = i;
+	return env->vars->slots + i;
+      }
+    } else if ((r = FACT_find_in_table (env->vars, name, ic->hash)) != NULL) {
+      ic->table = env->vars;
+      goto fill;
+    }
+  }
+
+  r = FACT_find_in_table (&Furlow_globals, name, ic->hash);
+  ic->table = &Furlow_globals;
+ fill:
+  ic->depth = d;
+  ic->shape = NULL;
+  ic->version = ic->table->version;
+  ic->hit = r;
+  return r;
+}
+
+/* Same as FACT_get_local, but use the inline cache ic. */
+FACT_t *FACT_get_local_cached (FACT_scope_t env, char *name, struct FACT_icache *ic)
+{
+  fill_icache (ic, name);
+
+  /* Check the bloom filter before anything else. */
+  if (!(env->vars->bloom & FACT_bloom_bit (ic->hash)))
+    return NULL;
+
+  if (env->vars->buckets == NULL) {
+    /* Shape mode, the slot only has to be found once per shape. */
+    if (ic->shape != env->vars->shape) {
+      ic->shape = env->vars->shape;
+      ic->slot = FACT_shape_slot (ic->shape, name, ic->hash);
+    }
+    return (ic->slot == -1) ? NULL : env->vars->slots + ic->slot;
+  }
+
+  ic->shape = NULL;
+  if (ic->table != env->vars || ic->version != env->vars->version) {
+    ic->table = env->vars;
+    ic->version = env->vars->version;
+    ic->hit = FACT_find_in_table (env->vars, name, ic->hash);
+  }
+  
+  return ic->hit;
+}
+
+void FACT_get_var (char *name, struct FACT_icache *ic) /* Search all relevent scopes for a variable and push it to the stack. */
 {
-  FACT_t new;
   FACT_t *res;
-  size_t h;
 
   /* Get the variable. If it doesn't exist, throw an error. */
-  res = FACT_get_global (CURR_THIS, name);
+  res = FACT_get_global_cached (CURR_THIS, name, ic);
   if (res == NULL)
     FACT_throw_error (CURR_THIS, "undefined variable: %s", name);
 
-#if 0
-  h = FACT_get_hash (name, strlen (name));
-  if ((res = FACT_find_in_table (CURR_THIS->vars, name, h)) == NULL)
-    if ((res = FACT_find_in_table (&Furlow_globals, name, h)) == NULL) {
-      /* Add an unset variable. */
-      new.type = UNSET_TYPE;
-      new.ap = name;
-      new.home = CURR_THIS->vars;
-      res = &new;
-    }
-#endif
-
   /* Push the variable to the var stack. */
   push_v (*res);
 }
 
 bool FACT_is_circular (FACT_scope_t env)
 {
-  bool r;
-  
-  if (env == NULL)
-    return false;
-  if (*env->marked)
-    return true;
-  *env->marked = true;
-  r = FACT_is_circular (env->up);
-  *env->marked = false;
-  return r;
+  FACT_scope_t fast;
+
+  /* Compare the links themselves rather than the marked flags, as scopes
+   * copied by assignment share their flag with the original.
+   */
+  for (fast = env; fast != NULL && fast->up != NULL; ) {
+    env = env->up;
+    fast = fast->up->up;
+    if (env == fast)
+      return true;
+  }
+  return false;
 }
@@ -20,9 +20,29 @@
 #include "FACT_hash.h"
 #include "FACT_types.h"
 
+/* Inline cache for the VAR, IS_DEF and IS_AUTO instructions. Every thread
+ * keeps one per instruction, recording where the instruction's name last
+ * resolved. A hit is validated by checking the bloom filters of the scopes
+ * passed over, and then either the shape of the scope the name was found in
+ * or the version stamp of its table if it is a dictionary. Since shapes are
+ * shared, a hit in shape mode carries over to every scope with that shape.
+ */
+struct FACT_icache {
+  char *name;               /* Operand the cache was filled for, NULL if empty. */
+  size_t hash;              /* Hash of the name, which is a symbol.             */
+  size_t depth;             /* Scopes passed over before the name resolved.     */
+  struct FACT_shape *shape; /* Shape the name resolved in, NULL if none.        */
+  long slot;                /* Slot of the name in the shape, -1 if none.       */
+  FACT_table_t *table;      /* Dictionary the name resolved in.                 */
+  size_t version;           /* Version stamp of the dictionary when filled.     */
+  FACT_t *hit;              /* Cached result, NULL for a negative result.       */
+};
+
 /* Retrieving variables:                                                                           */
-void FACT_get_var (char *);                     /* Search for a variable and push it to the stack. */
-FACT_t *FACT_get_global (FACT_scope_t, char *); /* Search for a global variable.                   */
+void FACT_get_var (char *, struct FACT_icache *); /* Search for a variable and push it.            */
+FACT_t *FACT_get_global (FACT_scope_t, char *);   /* Search for a global variable.                 */
+FACT_t *FACT_get_global_cached (FACT_scope_t, char *, struct FACT_icache *);
+FACT_t *FACT_get_local_cached (FACT_scope_t, char *, struct FACT_icache *);
 
 static inline FACT_t *FACT_get_local (FACT_scope_t env, char *name)
 {
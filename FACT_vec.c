@@ -0,0 +1,1008 @@
+/* This file is part of FACT.
+ *
+ * FACT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FACT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FACT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FACT.h"
+#include "FACT_vm.h"
+#include "FACT_error.h"
+#include "FACT_types.h"
+#include "FACT_alloc.h"
+#include "FACT_num.h"
+#include "FACT_vec.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+# define VEC_X86
+# include <immintrin.h>
+#endif
+
+/* Vector operations on number arrays. f64 and i64 arrays are worked on
+ * directly through a table of kernels, picked for the CPU when FACT
+ * starts. Anything else, and any i64 operation that overflows, is done
+ * element by element on FACT_nums.
+ */
+
+/* The kernels. b_scalar means b points to a single value to be used for
+ * every element. The i64 kernels return false on overflow or division by
+ * zero, leaving the result undefined.
+ */
+struct vec_kernels {
+  void (*arith_d) (FACT_vec_op, double *, const double *, const double *, bool, size_t);
+  bool (*arith_q) (FACT_vec_op, int64_t *, const int64_t *, const int64_t *, bool, size_t);
+  void (*cmp_d) (FACT_vec_cmp, uint8_t *, const double *, const double *, bool, size_t);
+  void (*cmp_q) (FACT_vec_cmp, uint8_t *, const int64_t *, const int64_t *, bool, size_t);
+  void (*fill) (uint64_t *, uint64_t, size_t);
+  double (*sum_d) (const double *, size_t);
+  bool (*sum_q) (int64_t *, const int64_t *, size_t);
+  double (*dot_d) (const double *, const double *, size_t);
+  double (*ext_d) (bool, const double *, size_t);
+  int64_t (*ext_q) (bool, const int64_t *, size_t);
+};
+
+/* Scalar kernels, used when nothing better is available and to finish
+ * off what the vector kernels leave over.
+ */
+static void arith_d_scalar (FACT_vec_op op, double *r, const double *a, const double *b, bool b_scalar, size_t n)
+{
+  size_t i, s;
+
+  s = !b_scalar;
+  switch (op) {
+  case VEC_ADD:
+    for (i = 0; i < n; i++)
+      r[i] = a[i] + b[i * s];
+    break;
+
+  case VEC_SUB:
+    for (i = 0; i < n; i++)
+      r[i] = a[i] - b[i * s];
+    break;
+
+  case VEC_MUL:
+    for (i = 0; i < n; i++)
+      r[i] = a[i] * b[i * s];
+    break;
+
+  case VEC_DIV:
+    for (i = 0; i < n; i++)
+      r[i] = a[i] / b[i * s];
+    break;
+  }
+}
+
+static bool arith_q_scalar (FACT_vec_op op, int64_t *r, const int64_t *a, const int64_t *b, bool b_scalar, size_t n)
+{
+  size_t i, s;
+
+  s = !b_scalar;
+  for (i = 0; i < n; i++) {
+    switch (op) {
+    case VEC_ADD:
+      if (__builtin_add_overflow (a[i], b[i * s], r + i))
+	return false;
+      break;
+
+    case VEC_SUB:
+      if (__builtin_sub_overflow (a[i], b[i * s], r + i))
+	return false;
+      break;
+
+    case VEC_MUL:
+      if (__builtin_mul_overflow (a[i], b[i * s], r + i))
+	return false;
+      break;
+
+    case VEC_DIV:
+      /* Truncate, like mpz_tdiv_q. */
+      if (b[i * s] == 0 || (a[i] == INT64_MIN && b[i * s] == -1))
+	return false;
+      r[i] = a[i] / b[i * s];
+      break;
+    }
+  }
+  return true;
+}
+
+#define CMP_LOOP(OP) for (i = 0; i < n; i++) mask[i] = (a[i] OP b[i * s])
+
+static void cmp_d_scalar (FACT_vec_cmp op, uint8_t *mask, const double *a, const double *b, bool b_scalar, size_t n)
+{
+  size_t i, s;
+
+  s = !b_scalar;
+  switch (op) {
+  case VEC_EQ: CMP_LOOP (==); break;
+  case VEC_NE: CMP_LOOP (!=); break;
+  case VEC_LT: CMP_LOOP (<);  break;
+  case VEC_LE: CMP_LOOP (<=); break;
+  case VEC_GT: CMP_LOOP (>);  break;
+  case VEC_GE: CMP_LOOP (>=); break;
+  }
+}
+
+static void cmp_q_scalar (FACT_vec_cmp op, uint8_t *mask, const int64_t *a, const int64_t *b, bool b_scalar, size_t n)
+{
+  size_t i, s;
+
+  s = !b_scalar;
+  switch (op) {
+  case VEC_EQ: CMP_LOOP (==); break;
+  case VEC_NE: CMP_LOOP (!=); break;
+  case VEC_LT: CMP_LOOP (<);  break;
+  case VEC_LE: CMP_LOOP (<=); break;
+  case VEC_GT: CMP_LOOP (>);  break;
+  case VEC_GE: CMP_LOOP (>=); break;
+  }
+}
+
+static void fill_scalar (uint64_t *r, uint64_t v, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    r[i] = v;
+}
+
+static double sum_d_scalar (const double *a, size_t n)
+{
+  size_t i;
+  double s;
+
+  for (i = 0, s = 0; i < n; i++)
+    s += a[i];
+  return s;
+}
+
+static bool sum_q_scalar (int64_t *rop, const int64_t *a, size_t n)
+{
+  size_t i;
+  int64_t s;
+
+  for (i = 0, s = 0; i < n; i++) {
+    if (__builtin_add_overflow (s, a[i], &s))
+      return false;
+  }
+  *rop = s;
+  return true;
+}
+
+static double dot_d_scalar (const double *a, const double *b, size_t n)
+{
+  size_t i;
+  double s;
+
+  for (i = 0, s = 0; i < n; i++)
+    s += a[i] * b[i];
+  return s;
+}
+
+static double ext_d_scalar (bool max, const double *a, size_t n)
+{
+  size_t i;
+  double m;
+
+  for (i = 1, m = a[0]; i < n; i++) {
+    if (max ? a[i] > m : a[i] < m)
+      m = a[i];
+  }
+  return m;
+}
+
+static int64_t ext_q_scalar (bool max, const int64_t *a, size_t n)
+{
+  size_t i;
+  int64_t m;
+
+  for (i = 1, m = a[0]; i < n; i++) {
+    if (max ? a[i] > m : a[i] < m)
+      m = a[i];
+  }
+  return m;
+}
+
+static const struct vec_kernels scalar_kernels = {
+  arith_d_scalar, arith_q_scalar, cmp_d_scalar, cmp_q_scalar, fill_scalar,
+  sum_d_scalar, sum_q_scalar, dot_d_scalar, ext_d_scalar, ext_q_scalar,
+};
+
+#ifdef VEC_X86
+/* SSE2 kernels, two elements at a time. SSE2 has no 64 bit integer
+ * compares, so those stay scalar.
+ */
+#define SSE2 __attribute__ ((target ("sse2")))
+
+/* Overflow of a + b = r, or a - b = r, shows up in the sign bits. */
+#define SSE2_ADD_OV(a, b, r) _mm_and_si128 (_mm_xor_si128 (a, r), _mm_xor_si128 (b, r))
+#define SSE2_SUB_OV(a, b, r) _mm_and_si128 (_mm_xor_si128 (a, b), _mm_xor_si128 (a, r))
+#define SSE2_SIGNS(v) _mm_movemask_pd (_mm_castsi128_pd (v))
+
+SSE2 static void arith_d_sse2 (FACT_vec_op op, double *r, const double *a, const double *b, bool b_scalar, size_t n)
+{
+  size_t i;
+  __m128d x, y;
+
+#define SSE2_ARITH_LOOP(F)						\
+  for (i = 0; i + 2 <= n; i += 2) {					\
+    x = _mm_loadu_pd (a + i);						\
+    y = b_scalar ? _mm_set1_pd (*b) : _mm_loadu_pd (b + i);		\
+    _mm_storeu_pd (r + i, F (x, y));					\
+  }
+
+  switch (op) {
+  case VEC_ADD: SSE2_ARITH_LOOP (_mm_add_pd); break;
+  case VEC_SUB: SSE2_ARITH_LOOP (_mm_sub_pd); break;
+  case VEC_MUL: SSE2_ARITH_LOOP (_mm_mul_pd); break;
+  case VEC_DIV: SSE2_ARITH_LOOP (_mm_div_pd); break;
+  default: abort ();
+  }
+  arith_d_scalar (op, r + i, a + i, b_scalar ? b : b + i, b_scalar, n - i);
+}
+
+SSE2 static bool arith_q_sse2 (FACT_vec_op op, int64_t *r, const int64_t *a, const int64_t *b, bool b_scalar, size_t n)
+{
+  size_t i;
+  __m128i x, y, z, ov;
+
+  if (op != VEC_ADD && op != VEC_SUB)
+    return arith_q_scalar (op, r, a, b, b_scalar, n);
+
+  ov = _mm_setzero_si128 ();
+  for (i = 0; i + 2 <= n; i += 2) {
+    x = _mm_loadu_si128 ((const __m128i *) (a + i));
+    y = (b_scalar
+	 ? _mm_set1_epi64x (*b)
+	 : _mm_loadu_si128 ((const __m128i *) (b + i)));
+    if (op == VEC_ADD) {
+      z = _mm_add_epi64 (x, y);
+      ov = _mm_or_si128 (ov, SSE2_ADD_OV (x, y, z));
+    } else {
+      z = _mm_sub_epi64 (x, y);
+      ov = _mm_or_si128 (ov, SSE2_SUB_OV (x, y, z));
+    }
+    _mm_storeu_si128 ((__m128i *) (r + i), z);
+  }
+  if (SSE2_SIGNS (ov))
+    return false;
+  return arith_q_scalar (op, r + i, a + i, b_scalar ? b : b + i, b_scalar, n - i);
+}
+
+SSE2 static void cmp_d_sse2 (FACT_vec_cmp op, uint8_t *mask, const double *a, const double *b, bool b_scalar, size_t n)
+{
+  int m;
+  size_t i;
+  __m128d x, y, c;
+
+  for (i = 0; i + 2 <= n; i += 2) {
+    x = _mm_loadu_pd (a + i);
+    y = b_scalar ? _mm_set1_pd (*b) : _mm_loadu_pd (b + i);
+    switch (op) {
+    case VEC_EQ: c = _mm_cmpeq_pd (x, y);  break;
+    case VEC_NE: c = _mm_cmpneq_pd (x, y); break;
+    case VEC_LT: c = _mm_cmplt_pd (x, y);  break;
+    case VEC_LE: c = _mm_cmple_pd (x, y);  break;
+    case VEC_GT: c = _mm_cmpgt_pd (x, y);  break;
+    case VEC_GE: c = _mm_cmpge_pd (x, y);  break;
+    default: abort ();
+    }
+    m = _mm_movemask_pd (c);
+    mask[i] = m & 1;
+    mask[i + 1] = (m >> 1) & 1;
+  }
+  cmp_d_scalar (op, mask + i, a + i, b_scalar ? b : b + i, b_scalar, n - i);
+}
+
+SSE2 static void fill_sse2 (uint64_t *r, uint64_t v, size_t n)
+{
+  size_t i;
+  __m128i x;
+
+  x = _mm_set1_epi64x (v);
+  for (i = 0; i + 2 <= n; i += 2)
+    _mm_storeu_si128 ((__m128i *) (r + i), x);
+  fill_scalar (r + i, v, n - i);
+}
+
+SSE2 static double sum_d_sse2 (const double *a, size_t n)
+{
+  size_t i;
+  double s[2];
+  __m128d acc;
+
+  acc = _mm_setzero_pd ();
+  for (i = 0; i + 2 <= n; i += 2)
+    acc = _mm_add_pd (acc, _mm_loadu_pd (a + i));
+  _mm_storeu_pd (s, acc);
+  return s[0] + s[1] + sum_d_scalar (a + i, n - i);
+}
+
+SSE2 static bool sum_q_sse2 (int64_t *rop, const int64_t *a, size_t n)
+{
+  size_t i;
+  int64_t s[3];
+  __m128i acc, x, z, ov;
+
+  acc = ov = _mm_setzero_si128 ();
+  for (i = 0; i + 2 <= n; i += 2) {
+    x = _mm_loadu_si128 ((const __m128i *) (a + i));
+    z = _mm_add_epi64 (acc, x);
+    ov = _mm_or_si128 (ov, SSE2_ADD_OV (acc, x, z));
+    acc = z;
+  }
+  if (SSE2_SIGNS (ov))
+    return false;
+  _mm_storeu_si128 ((__m128i *) s, acc);
+  return (sum_q_scalar (s + 2, a + i, n - i)
+	  && !__builtin_add_overflow (s[0], s[1], s)
+	  && !__builtin_add_overflow (s[0], s[2], rop));
+}
+
+SSE2 static double dot_d_sse2 (const double *a, const double *b, size_t n)
+{
+  size_t i;
+  double s[2];
+  __m128d acc;
+
+  acc = _mm_setzero_pd ();
+  for (i = 0; i + 2 <= n; i += 2)
+    acc = _mm_add_pd (acc, _mm_mul_pd (_mm_loadu_pd (a + i), _mm_loadu_pd (b + i)));
+  _mm_storeu_pd (s, acc);
+  return s[0] + s[1] + dot_d_scalar (a + i, b + i, n - i);
+}
+
+SSE2 static double ext_d_sse2 (bool max, const double *a, size_t n)
+{
+  size_t i;
+  double m[2];
+  __m128d acc;
+
+  if (n < 2)
+    return ext_d_scalar (max, a, n);
+
+  acc = _mm_loadu_pd (a);
+  for (i = 2; i + 2 <= n; i += 2)
+    acc = (max
+	   ? _mm_max_pd (acc, _mm_loadu_pd (a + i))
+	   : _mm_min_pd (acc, _mm_loadu_pd (a + i)));
+  _mm_storeu_pd (m, acc);
+  for (; i < n; i++)
+    m[0] = (max ? a[i] > m[0] : a[i] < m[0]) ? a[i] : m[0];
+  return ext_d_scalar (max, m, 2);
+}
+
+static const struct vec_kernels sse2_kernels = {
+  arith_d_sse2, arith_q_sse2, cmp_d_sse2, cmp_q_scalar, fill_sse2,
+  sum_d_sse2, sum_q_sse2, dot_d_sse2, ext_d_sse2, ext_q_scalar,
+};
+
+/* AVX2 kernels, four elements at a time. */
+#define AVX2 __attribute__ ((target ("avx2")))
+
+#define AVX2_ADD_OV(a, b, r) _mm256_and_si256 (_mm256_xor_si256 (a, r), _mm256_xor_si256 (b, r))
+#define AVX2_SUB_OV(a, b, r) _mm256_and_si256 (_mm256_xor_si256 (a, b), _mm256_xor_si256 (a, r))
+#define AVX2_SIGNS(v) _mm256_movemask_pd (_mm256_castsi256_pd (v))
+
+AVX2 static void arith_d_avx2 (FACT_vec_op op, double *r, const double *a, const double *b, bool b_scalar, size_t n)
+{
+  size_t i;
+  __m256d x, y;
+
+#define AVX2_ARITH_LOOP(F)						\
+  for (i = 0; i + 4 <= n; i += 4) {					\
+    x = _mm256_loadu_pd (a + i);					\
+    y = b_scalar ? _mm256_set1_pd (*b) : _mm256_loadu_pd (b + i);	\
+    _mm256_storeu_pd (r + i, F (x, y));					\
+  }
+
+  switch (op) {
+  case VEC_ADD: AVX2_ARITH_LOOP (_mm256_add_pd); break;
+  case VEC_SUB: AVX2_ARITH_LOOP (_mm256_sub_pd); break;
+  case VEC_MUL: AVX2_ARITH_LOOP (_mm256_mul_pd); break;
+  case VEC_DIV: AVX2_ARITH_LOOP (_mm256_div_pd); break;
+  default: abort ();
+  }
+  arith_d_scalar (op, r + i, a + i, b_scalar ? b : b + i, b_scalar, n - i);
+}
+
+AVX2 static bool arith_q_avx2 (FACT_vec_op op, int64_t *r, const int64_t *a, const int64_t *b, bool b_scalar, size_t n)
+{
+  size_t i;
+  __m256i x, y, z, ov;
+
+  /* There is no 64 bit multiply or divide. */
+  if (op != VEC_ADD && op != VEC_SUB)
+    return arith_q_scalar (op, r, a, b, b_scalar, n);
+
+  ov = _mm256_setzero_si256 ();
+  for (i = 0; i + 4 <= n; i += 4) {
+    x = _mm256_loadu_si256 ((const __m256i *) (a + i));
+    y = (b_scalar
+	 ? _mm256_set1_epi64x (*b)
+	 : _mm256_loadu_si256 ((const __m256i *) (b + i)));
+    if (op == VEC_ADD) {
+      z = _mm256_add_epi64 (x, y);
+      ov = _mm256_or_si256 (ov, AVX2_ADD_OV (x, y, z));
+    } else {
+      z = _mm256_sub_epi64 (x, y);
+      ov = _mm256_or_si256 (ov, AVX2_SUB_OV (x, y, z));
+    }
+    _mm256_storeu_si256 ((__m256i *) (r + i), z);
+  }
+  if (AVX2_SIGNS (ov))
+    return false;
+  return arith_q_scalar (op, r + i, a + i, b_scalar ? b : b + i, b_scalar, n - i);
+}
+
+AVX2 static void cmp_d_avx2 (FACT_vec_cmp op, uint8_t *mask, const double *a, const double *b, bool b_scalar, size_t n)
+{
+  int j, m;
+  size_t i;
+  __m256d x, y, c;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    x = _mm256_loadu_pd (a + i);
+    y = b_scalar ? _mm256_set1_pd (*b) : _mm256_loadu_pd (b + i);
+    switch (op) {
+    case VEC_EQ: c = _mm256_cmp_pd (x, y, _CMP_EQ_OQ);  break;
+    case VEC_NE: c = _mm256_cmp_pd (x, y, _CMP_NEQ_UQ); break;
+    case VEC_LT: c = _mm256_cmp_pd (x, y, _CMP_LT_OQ);  break;
+    case VEC_LE: c = _mm256_cmp_pd (x, y, _CMP_LE_OQ);  break;
+    case VEC_GT: c = _mm256_cmp_pd (x, y, _CMP_GT_OQ);  break;
+    case VEC_GE: c = _mm256_cmp_pd (x, y, _CMP_GE_OQ);  break;
+    default: abort ();
+    }
+    m = _mm256_movemask_pd (c);
+    for (j = 0; j < 4; j++)
+      mask[i + j] = (m >> j) & 1;
+  }
+  cmp_d_scalar (op, mask + i, a + i, b_scalar ? b : b + i, b_scalar, n - i);
+}
+
+AVX2 static void cmp_q_avx2 (FACT_vec_cmp op, uint8_t *mask, const int64_t *a, const int64_t *b, bool b_scalar, size_t n)
+{
+  int j, m;
+  size_t i;
+  __m256i x, y, c;
+
+  /* Only == and > exist, the rest are made by swapping and inverting. */
+  for (i = 0; i + 4 <= n; i += 4) {
+    x = _mm256_loadu_si256 ((const __m256i *) (a + i));
+    y = (b_scalar
+	 ? _mm256_set1_epi64x (*b)
+	 : _mm256_loadu_si256 ((const __m256i *) (b + i)));
+    switch (op) {
+    case VEC_EQ: case VEC_NE: c = _mm256_cmpeq_epi64 (x, y); break;
+    case VEC_GT: case VEC_LE: c = _mm256_cmpgt_epi64 (x, y); break;
+    case VEC_LT: case VEC_GE: c = _mm256_cmpgt_epi64 (y, x); break;
+    default: abort ();
+    }
+    m = AVX2_SIGNS (c);
+    if (op == VEC_NE || op == VEC_LE || op == VEC_GE)
+      m = ~m;
+    for (j = 0; j < 4; j++)
+      mask[i + j] = (m >> j) & 1;
+  }
+  cmp_q_scalar (op, mask + i, a + i, b_scalar ? b : b + i, b_scalar, n - i);
+}
+
+AVX2 static void fill_avx2 (uint64_t *r, uint64_t v, size_t n)
+{
+  size_t i;
+  __m256i x;
+
+  x = _mm256_set1_epi64x (v);
+  for (i = 0; i + 4 <= n; i += 4)
+    _mm256_storeu_si256 ((__m256i *) (r + i), x);
+  fill_scalar (r + i, v, n - i);
+}
+
+AVX2 static double sum_d_avx2 (const double *a, size_t n)
+{
+  size_t i;
+  double s[4];
+  __m256d acc;
+
+  acc = _mm256_setzero_pd ();
+  for (i = 0; i + 4 <= n; i += 4)
+    acc = _mm256_add_pd (acc, _mm256_loadu_pd (a + i));
+  _mm256_storeu_pd (s, acc);
+  return (s[0] + s[1]) + (s[2] + s[3]) + sum_d_scalar (a + i, n - i);
+}
+
+AVX2 static bool sum_q_avx2 (int64_t *rop, const int64_t *a, size_t n)
+{
+  int j;
+  size_t i;
+  int64_t s[4], t;
+  __m256i acc, x, z, ov;
+
+  acc = ov = _mm256_setzero_si256 ();
+  for (i = 0; i + 4 <= n; i += 4) {
+    x = _mm256_loadu_si256 ((const __m256i *) (a + i));
+    z = _mm256_add_epi64 (acc, x);
+    ov = _mm256_or_si256 (ov, AVX2_ADD_OV (acc, x, z));
+    acc = z;
+  }
+  if (AVX2_SIGNS (ov) || !sum_q_scalar (&t, a + i, n - i))
+    return false;
+  _mm256_storeu_si256 ((__m256i *) s, acc);
+  for (j = 0; j < 4; j++) {
+    if (__builtin_add_overflow (t, s[j], &t))
+      return false;
+  }
+  *rop = t;
+  return true;
+}
+
+AVX2 static double dot_d_avx2 (const double *a, const double *b, size_t n)
+{
+  size_t i;
+  double s[4];
+  __m256d acc;
+
+  acc = _mm256_setzero_pd ();
+  for (i = 0; i + 4 <= n; i += 4)
+    acc = _mm256_add_pd (acc, _mm256_mul_pd (_mm256_loadu_pd (a + i), _mm256_loadu_pd (b + i)));
+  _mm256_storeu_pd (s, acc);
+  return (s[0] + s[1]) + (s[2] + s[3]) + dot_d_scalar (a + i, b + i, n - i);
+}
+
+AVX2 static double ext_d_avx2 (bool max, const double *a, size_t n)
+{
+  size_t i;
+  double m[5];
+  __m256d acc;
+
+  if (n < 4)
+    return ext_d_scalar (max, a, n);
+
+  acc = _mm256_loadu_pd (a);
+  for (i = 4; i + 4 <= n; i += 4)
+    acc = (max
+	   ? _mm256_max_pd (acc, _mm256_loadu_pd (a + i))
+	   : _mm256_min_pd (acc, _mm256_loadu_pd (a + i)));
+  _mm256_storeu_pd (m, acc);
+  m[4] = (i < n) ? ext_d_scalar (max, a + i, n - i) : m[0];
+  return ext_d_scalar (max, m, 5);
+}
+
+AVX2 static int64_t ext_q_avx2 (bool max, const int64_t *a, size_t n)
+{
+  size_t i;
+  int64_t m[5];
+  __m256i acc, x, c;
+
+  if (n < 4)
+    return ext_q_scalar (max, a, n);
+
+  acc = _mm256_loadu_si256 ((const __m256i *) a);
+  for (i = 4; i + 4 <= n; i += 4) {
+    x = _mm256_loadu_si256 ((const __m256i *) (a + i));
+    c = max ? _mm256_cmpgt_epi64 (x, acc) : _mm256_cmpgt_epi64 (acc, x);
+    acc = _mm256_blendv_epi8 (acc, x, c);
+  }
+  _mm256_storeu_si256 ((__m256i *) m, acc);
+  m[4] = (i < n) ? ext_q_scalar (max, a + i, n - i) : m[0];
+  return ext_q_scalar (max, m, 5);
+}
+
+static const struct vec_kernels avx2_kernels = {
+  arith_d_avx2, arith_q_avx2, cmp_d_avx2, cmp_q_avx2, fill_avx2,
+  sum_d_avx2, sum_q_avx2, dot_d_avx2, ext_d_avx2, ext_q_avx2,
+};
+#endif /* VEC_X86 */
+
+static const struct vec_kernels *kern = &scalar_kernels;
+
+void FACT_init_vec (void) /* Select the kernels for this CPU. */
+{
+#ifdef VEC_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    kern = &avx2_kernels;
+  else if (__builtin_cpu_supports ("sse2"))
+    kern = &sse2_kernels;
+#endif /* VEC_X86 */
+}
+
+static void check_array (FACT_num_t op) /* Make sure an argument is an array. */
+{
+  if (op->array_size == 0)
+    FACT_throw_error (CURR_THIS, "argument must be an array");
+}
+
+static void check_operands (FACT_num_t a, FACT_num_t b) /* Make sure two arguments can be worked on together. */
+{
+  check_array (a);
+  if (b->array_size != 0 && b->array_size != a->array_size)
+    FACT_throw_error (CURR_THIS, "array sizes do not match");
+}
+
+static bool packed (FACT_pack_t type, FACT_num_t a, FACT_num_t b) /* Check if a, and b if it's an array, are packed as type. */
+{
+  return (a->pack_type == type
+	  && (b->array_size == 0 || b->pack_type == type));
+}
+
+static bool get_q (FACT_num_t op, int64_t *rop) /* Get a number as an i64, if it is an integer that fits. */
+{
+  if (mpc_is_float (op->value) || !mpz_fits_slong_p (op->value->intv))
+    return false;
+  *rop = mpc_get_si (op->value);
+  return true;
+}
+
+static void check_finite (const double *a, size_t n) /* Floats that overflowed can't be stored. */
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if (!isfinite (a[i]))
+      FACT_throw_error (CURR_THIS, "value does not fit in an f64 array");
+  }
+}
+
+static FACT_num_t operand (FACT_num_t op, size_t i) /* Element i of op, or op itself if it's a number. */
+{
+  FACT_num_t res;
+
+  if (op->array_size == 0)
+    return op;
+  res = FACT_get_elem (op, i);
+  if (res->array_size != 0)
+    FACT_throw_error (CURR_THIS, "vector operations need flat arrays");
+  return res;
+}
+
+static FACT_num_t new_array (size_t n) /* Make an anonymous array of n numbers. */
+{
+  FACT_num_t res;
+
+  res = FACT_alloc_num ();
+  res->array_size = n;
+  res->array_up = FACT_alloc_num_array (n);
+  return res;
+}
+
+FACT_num_t FACT_vec_arith (FACT_vec_op op, FACT_num_t a, FACT_num_t b)
+{
+  size_t i, n;
+  double bd;
+  int64_t bq;
+  FACT_num_t res, x, y;
+
+  check_operands (a, b);
+  n = a->array_size;
+
+  if (packed (PACK_F64, a, b)) {
+    bd = (b->array_size == 0) ? mpc_get_d (b->value) : 0;
+    res = FACT_make_typed (PACK_F64, n);
+    if (op == VEC_DIV) {
+      for (i = 0; i < (b->array_size == 0 ? 1 : n); i++) {
+	if ((b->array_size == 0 ? bd : ((double *) b->pack)[i]) == 0)
+	  FACT_throw_error (CURR_THIS, "division by zero error");
+      }
+    }
+    kern->arith_d (op, res->pack, a->pack,
+		   (b->array_size == 0) ? &bd : b->pack,
+		   b->array_size == 0, n);
+    check_finite (res->pack, n);
+    return res;
+  }
+
+  if (packed (PACK_I64, a, b) && (b->array_size != 0 || get_q (b, &bq))) {
+    res = FACT_make_typed (PACK_I64, n);
+    if (kern->arith_q (op, res->pack, a->pack,
+		       (b->array_size == 0) ? &bq : b->pack,
+		       b->array_size == 0, n))
+      return res;
+    /* Overflowed or divided by zero, fall through to the slow way. */
+  }
+
+  res = new_array (n);
+  for (i = 0; i < n; i++) {
+    x = operand (a, i);
+    y = operand (b, i);
+    switch (op) {
+    case VEC_ADD:
+      mpc_add (res->array_up[i]->value, x->value, y->value);
+      break;
+
+    case VEC_SUB:
+      mpc_sub (res->array_up[i]->value, x->value, y->value);
+      break;
+
+    case VEC_MUL:
+      mpc_mul (res->array_up[i]->value, x->value, y->value);
+      break;
+
+    case VEC_DIV:
+      if (!mpc_cmp_ui (y->value, 0))
+	FACT_throw_error (CURR_THIS, "division by zero error");
+      mpc_div (res->array_up[i]->value, x->value, y->value);
+      break;
+    }
+  }
+
+  return res;
+}
+
+FACT_num_t FACT_vec_compare (FACT_vec_cmp op, FACT_num_t a, FACT_num_t b)
+{
+  int c;
+  size_t i, n;
+  double bd;
+  int64_t bq;
+  uint8_t *mask;
+  FACT_num_t res;
+
+  check_operands (a, b);
+  n = a->array_size;
+  res = FACT_make_typed (PACK_U8, n);
+  mask = res->pack;
+
+  if (packed (PACK_F64, a, b)) {
+    bd = (b->array_size == 0) ? mpc_get_d (b->value) : 0;
+    kern->cmp_d (op, mask, a->pack,
+		 (b->array_size == 0) ? &bd : b->pack,
+		 b->array_size == 0, n);
+    return res;
+  }
+
+  if (packed (PACK_I64, a, b) && (b->array_size != 0 || get_q (b, &bq))) {
+    kern->cmp_q (op, mask, a->pack,
+		 (b->array_size == 0) ? &bq : b->pack,
+		 b->array_size == 0, n);
+    return res;
+  }
+
+  for (i = 0; i < n; i++) {
+    c = mpc_cmp (operand (a, i)->value, operand (b, i)->value);
+    switch (op) {
+    case VEC_EQ: mask[i] = (c == 0); break;
+    case VEC_NE: mask[i] = (c != 0); break;
+    case VEC_LT: mask[i] = (c < 0);  break;
+    case VEC_LE: mask[i] = (c <= 0); break;
+    case VEC_GT: mask[i] = (c > 0);  break;
+    case VEC_GE: mask[i] = (c >= 0); break;
+    }
+  }
+
+  return res;
+}
+
+FACT_num_t FACT_vec_reduce (FACT_vec_red red, FACT_num_t a)
+{
+  size_t i, n;
+  double d;
+  int64_t q;
+  mpc_t count;
+  FACT_num_t res, x;
+
+  check_array (a);
+  n = a->array_size;
+  res = FACT_alloc_num ();
+
+  if (a->pack_type == PACK_F64) {
+    d = ((red == VEC_MIN || red == VEC_MAX)
+	 ? kern->ext_d (red == VEC_MAX, a->pack, n)
+	 : kern->sum_d (a->pack, n));
+    check_finite (&d, 1);
+    mpc_set_d (res->value, d);
+  } else if (a->pack_type == PACK_I64 && (red == VEC_MIN || red == VEC_MAX))
+    mpc_set_si (res->value, kern->ext_q (red == VEC_MAX, a->pack, n));
+  else if (a->pack_type == PACK_I64 && kern->sum_q (&q, a->pack, n))
+    mpc_set_si (res->value, q);
+  else {
+    /* Go element by element. */
+    mpc_set (res->value, operand (a, 0)->value);
+    for (i = 1; i < n; i++) {
+      x = operand (a, i);
+      if (red == VEC_SUM || red == VEC_MEAN)
+	mpc_add (res->value, res->value, x->value);
+      else if ((red == VEC_MAX)
+	       ? mpc_cmp (x->value, res->value) > 0
+	       : mpc_cmp (x->value, res->value) < 0)
+	mpc_set (res->value, x->value);
+    }
+  }
+
+  if (red == VEC_MEAN) {
+    /* Dividing by a float gives a float. */
+    mpc_init (count);
+    mpc_set_d (count, (double) n);
+    mpc_div (res->value, res->value, count);
+    mpc_clear (count);
+  }
+
+  return res;
+}
+
+FACT_num_t FACT_vec_dot (FACT_num_t a, FACT_num_t b)
+{
+  size_t i, n;
+  double d;
+  int64_t p, q;
+  mpc_t t;
+  FACT_num_t res;
+
+  check_array (b);
+  check_operands (a, b);
+  n = a->array_size;
+  res = FACT_alloc_num ();
+
+  if (packed (PACK_F64, a, b)) {
+    d = kern->dot_d (a->pack, b->pack, n);
+    check_finite (&d, 1);
+    mpc_set_d (res->value, d);
+    return res;
+  }
+
+  if (packed (PACK_I64, a, b)) {
+    /* Nothing multiplies 64 bit integers in parallel. */
+    for (i = 0, q = 0; i < n; i++) {
+      if (__builtin_mul_overflow (((int64_t *) a->pack)[i], ((int64_t *) b->pack)[i], &p)
+	  || __builtin_add_overflow (q, p, &q))
+	break;
+    }
+    if (i == n) {
+      mpc_set_si (res->value, q);
+      return res;
+    }
+  }
+
+  mpc_init (t);
+  for (i = 0; i < n; i++) {
+    mpc_mul (t, operand (a, i)->value, operand (b, i)->value);
+    mpc_add (res->value, res->value, t);
+  }
+  mpc_clear (t);
+
+  return res;
+}
+
+FACT_num_t FACT_vec_scan (FACT_num_t a) /* Prefix sums of an array. */
+{
+  size_t i, n;
+  double *rd;
+  int64_t *rq;
+  FACT_num_t res;
+
+  /* Each sum depends on the last, so there's nothing to vectorize. */
+  check_array (a);
+  n = a->array_size;
+
+  if (a->pack_type == PACK_F64) {
+    res = FACT_make_typed (PACK_F64, n);
+    rd = res->pack;
+    for (i = 0, rd[0] = ((double *) a->pack)[0]; i + 1 < n; i++)
+      rd[i + 1] = rd[i] + ((double *) a->pack)[i + 1];
+    check_finite (rd, n);
+    return res;
+  }
+
+  if (a->pack_type == PACK_I64) {
+    res = FACT_make_typed (PACK_I64, n);
+    rq = res->pack;
+    for (i = 0, rq[0] = ((int64_t *) a->pack)[0]; i + 1 < n; i++) {
+      if (__builtin_add_overflow (rq[i], ((int64_t *) a->pack)[i + 1], rq + i + 1))
+	break;
+    }
+    if (i + 1 >= n)
+      return res;
+  }
+
+  res = new_array (n);
+  mpc_set (res->array_up[0]->value, operand (a, 0)->value);
+  for (i = 1; i < n; i++)
+    mpc_add (res->array_up[i]->value, res->array_up[i - 1]->value, operand (a, i)->value);
+
+  return res;
+}
+
+void FACT_vec_fill (FACT_num_t dst, FACT_num_t val) /* Set every element of an array to a number. */
+{
+  size_t i;
+  double d;
+  int64_t q;
+  uint64_t bits;
+  FACT_num_t elem;
+
+  check_array (dst);
+  if (dst->locked)
+    FACT_throw_error (CURR_THIS, "cannot set immutable variable");
+  if (val->array_size != 0)
+    FACT_throw_error (CURR_THIS, "fill value must be a number");
+
+  switch (dst->pack_type) {
+  case PACK_F64:
+    d = mpc_get_d (val->value);
+    check_finite (&d, 1);
+    memcpy (&bits, &d, sizeof bits);
+    kern->fill (dst->pack, bits, dst->array_size);
+    break;
+
+  case PACK_I64:
+    if (!get_q (val, &q))
+      FACT_throw_error (CURR_THIS, "value does not fit in an i64 array");
+    kern->fill (dst->pack, (uint64_t) q, dst->array_size);
+    break;
+
+  case PACK_U8:
+  case PACK_BYTES:
+    /* u8 arrays truncate floats, byte strings only take integers. */
+    if (mpc_cmp_si (val->value, 0) >= 0
+	&& mpc_cmp_ui (val->value, UINT8_MAX + 1) < 0
+	&& (dst->pack_type == PACK_U8 || mpc_is_int (val->value))) {
+      FACT_own_num (dst);
+      memset (dst->pack, mpc_get_ui (val->value), dst->array_size);
+      dst->hash = 0;
+      break;
+    }
+    if (dst->pack_type == PACK_U8)
+      FACT_throw_error (CURR_THIS, "value does not fit in a u8 array");
+    /* Fall through, the byte string is promoted by the first store. */
+
+  default:
+    for (i = 0; i < dst->array_size; i++) {
+      elem = FACT_get_elem (dst, i);
+      FACT_set_num (elem, val);
+      if (elem->owner != NULL)
+	FACT_sync_num (elem);
+    }
+    break;
+  }
+}
+
+void FACT_vec_copy (FACT_num_t dst, size_t dst_off, FACT_num_t src, size_t src_off, size_t count) /* Copy a slice of one array into another. */
+{
+  size_t i, j;
+  FACT_num_t elem;
+  static const size_t width[] = {
+    [PACK_I64] = sizeof (int64_t),
+    [PACK_F64] = sizeof (double),
+    [PACK_U8]  = sizeof (uint8_t),
+    [PACK_BYTES] = sizeof (uint8_t),
+  };
+
+  check_array (dst);
+  check_array (src);
+  if (dst->locked)
+    FACT_throw_error (CURR_THIS, "cannot set immutable variable");
+  if (dst_off > dst->array_size || count > dst->array_size - dst_off
+      || src_off > src->array_size || count > src->array_size - src_off)
+    FACT_throw_error (CURR_THIS, "out of bounds error");
+
+  if (dst->pack_type != PACK_NONE && dst->pack_type == src->pack_type) {
+    FACT_own_num (dst);
+    memmove ((char *) dst->pack + dst_off * width[dst->pack_type],
+	     (char *) src->pack + src_off * width[src->pack_type],
+	     count * width[dst->pack_type]);
+    dst->hash = 0;
+    return;
+  }
+
+  /* Copy backwards if the slices overlap that way. */
+  for (i = 0; i < count; i++) {
+    j = (dst == src && dst_off > src_off) ? count - i - 1 : i;
+    elem = FACT_get_elem (dst, dst_off + j);
+    FACT_set_num (elem, FACT_get_elem (src, src_off + j));
+    if (elem->owner != NULL)
+      FACT_sync_num (elem);
+  }
+}
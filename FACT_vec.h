@@ -0,0 +1,58 @@
+/* This file is part of FACT.
+ *
+ * FACT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FACT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FACT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FACT_VEC_H_
+#define FACT_VEC_H_
+
+#include "FACT_types.h"
+
+/* Element-wise operations. */
+typedef enum {
+  VEC_ADD = 0,
+  VEC_SUB,
+  VEC_MUL,
+  VEC_DIV,
+} FACT_vec_op;
+
+/* Element-wise comparisons, which produce u8 masks. */
+typedef enum {
+  VEC_EQ = 0,
+  VEC_NE,
+  VEC_LT,
+  VEC_LE,
+  VEC_GT,
+  VEC_GE,
+} FACT_vec_cmp;
+
+/* Reductions. */
+typedef enum {
+  VEC_SUM = 0,
+  VEC_MIN,
+  VEC_MAX,
+  VEC_MEAN,
+} FACT_vec_red;
+
+void FACT_init_vec (void); /* Select the kernels for this CPU. */
+
+FACT_num_t FACT_vec_arith (FACT_vec_op, FACT_num_t, FACT_num_t);
+FACT_num_t FACT_vec_compare (FACT_vec_cmp, FACT_num_t, FACT_num_t);
+FACT_num_t FACT_vec_reduce (FACT_vec_red, FACT_num_t);
+FACT_num_t FACT_vec_dot (FACT_num_t, FACT_num_t);
+FACT_num_t FACT_vec_scan (FACT_num_t);
+void FACT_vec_fill (FACT_num_t, FACT_num_t);
+void FACT_vec_copy (FACT_num_t, size_t, FACT_num_t, size_t, size_t);
+
+#endif /* FACT_VEC_H_ */
@@ -21,6 +21,12 @@
 #include "FACT_hash.h"
 #include "FACT_alloc.h"
 #include "FACT_var.h"
+#include "FACT_num.h"
+#include "FACT_scope.h"
+#include "FACT_strs.h"
+#include "FACT_threads.h"
+#include "FACT_sched.h"
+#include "FACT_error.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,26 +34,38 @@
 #include <pthread.h>
 #include <gmp.h>
 
-static void *Furlow_thread_mask(void *);
 static inline size_t get_seg_addr(char *);
+static inline struct FACT_icache *get_icache(void);
+static inline bool is_shadowed(struct Furlow_gslot *);
+static inline void recycle_frame(FACT_scope_t);
 
 /* Threading and stacks:                                        */
-size_t num_threads;                 /* Number of threads.       */
-FACT_thread_t threads;              /* Thread data.             */
+size_t num_threads;                 /* Number of live threads.  */
 __thread FACT_thread_t curr_thread; /* Specific data to thread. */
 
+/* The thread table is a set of chunks that never move once allocated,
+ * so threads can be looked up without taking threads_lock. Slots freed
+ * by dead threads are handed out again with their next ID.
+ */
+#define MAX_THREAD_CHUNKS ((1 << THREAD_SLOT_BITS) / THREAD_CHUNK_SIZE)
+
+static FACT_thread_t *thread_chunks[MAX_THREAD_CHUNKS];
+static size_t thread_slots;   /* Slots that have ever been used.   */
+static size_t *free_ids;      /* Next IDs of the freed slots.      */
+static size_t num_free_ids;
+static size_t free_ids_size;  /* Memory allocated to free_ids.     */
+
 /* Locks: */
 pthread_mutex_t progm_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Error recovery:                                               */
-__thread jmp_buf handle_err; /* Jump to the error handler.       */
-__thread jmp_buf recover;    /* When there are no other options. */
-
 /* The machine:                                         */
 static char **progm;     /* Program being run.          */
 static char **next_inst; /* Next available instruction. */
 
+/* Furlow_call returns to a HALT kept at this address. */
+#define CALL_RET_ADDR 1
+
 static void print_var_stack ();
 
 /* Global variables: */
@@ -57,6 +75,109 @@ FACT_table_t Furlow_globals = {
 	.num_entries = 0,
 };
 
+/* Global slots. They are allocated in chunks that never move, so GVAR
+ * reads them without a lock while the compiler reserves more on another
+ * thread. Reserving and binding slots are serialised by gslot_lock.
+ */
+#define GSLOT_CHUNK_SIZE 256
+#define MAX_GSLOT_CHUNKS 256
+#define GSLOT(n) (&gslot_chunks[(n) / GSLOT_CHUNK_SIZE][(n) % GSLOT_CHUNK_SIZE])
+
+static struct Furlow_gslot *gslot_chunks[MAX_GSLOT_CHUNKS];
+static size_t num_gslots;            /* Number of slots reserved.        */
+static uint64_t gslot_names[16];     /* Bloom of the names with a slot.  */
+static pthread_mutex_t gslot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define NAME_BIT(b, h) (__atomic_load_n (&(b)[((h) >> 6) & 15], __ATOMIC_SEQ_CST) \
+			& ((uint64_t) 1 << ((h) & 63)))
+#define SET_NAME_BIT(b, h) (__atomic_or_fetch (&(b)[((h) >> 6) & 15], \
+					       (uint64_t) 1 << ((h) & 63), __ATOMIC_SEQ_CST))
+
+long Furlow_find_gslot (char *name) /* Get the slot of a global symbol, -1 if it has none. */
+{
+  size_t i, h, n;
+
+  h = FACT_sym_hash (name);
+  if (!NAME_BIT (gslot_names, h))
+    return -1;
+
+  n = __atomic_load_n (&num_gslots, __ATOMIC_SEQ_CST);
+  for (i = 0; i < n; i++) {
+    if (GSLOT (i)->name == name)
+      return i;
+  }
+
+  return -1;
+}
+
+static size_t reserve_gslot (char *name) /* Furlow_reserve_gslot, with gslot_lock held. */
+{
+  long res;
+  size_t h;
+  struct Furlow_gslot *slot;
+
+  if ((res = Furlow_find_gslot (name)) != -1)
+    return res;
+
+  if (num_gslots == GSLOT_CHUNK_SIZE * MAX_GSLOT_CHUNKS) {
+    pthread_mutex_unlock (&gslot_lock);
+    FACT_throw_error (CURR_THIS, "too many global constants");
+  }
+  if (gslot_chunks[num_gslots / GSLOT_CHUNK_SIZE] == NULL)
+    gslot_chunks[num_gslots / GSLOT_CHUNK_SIZE] = FACT_malloc (sizeof (struct Furlow_gslot)
+							       * GSLOT_CHUNK_SIZE);
+
+  h = FACT_sym_hash (name);
+  slot = GSLOT (num_gslots);
+  slot->name = name;
+  slot->hash = h;
+  slot->var.type = UNSET_TYPE;
+  slot->var.ap = NULL;
+  __atomic_store_n (&num_gslots, num_gslots + 1, __ATOMIC_SEQ_CST);
+  SET_NAME_BIT (gslot_names, h);
+
+  return num_gslots - 1;
+}
+
+size_t Furlow_reserve_gslot (char *name) /* Get the slot of a global symbol, creating it if need be. */
+{
+  size_t res;
+
+  pthread_mutex_lock (&gslot_lock);
+  res = reserve_gslot (name);
+  pthread_mutex_unlock (&gslot_lock);
+
+  return res;
+}
+
+void Furlow_bind_global (FACT_t var) /* Add a variable to the globals table and bind its slot. */
+{
+  char *name;
+  FACT_t *found;
+  struct Furlow_gslot *slot;
+
+  /* Make sure the variable is named by a symbol. */
+  name = FACT_intern (FACT_var_name (var));
+  if (var.type == NUM_TYPE)
+    FACT_cast_to_num (var)->name = name;
+  else
+    FACT_cast_to_scope (var)->name = name;
+  FACT_add_to_table (&Furlow_globals, var);
+
+  pthread_mutex_lock (&gslot_lock);
+  slot = GSLOT (reserve_gslot (name));
+  /* Mirror the table, where the first definition of a name is the one
+   * found. The type is stored last, as GVAR checks it without the lock.
+   */
+  if (slot->var.type == UNSET_TYPE) {
+    found = FACT_find_in_table (&Furlow_globals, name, slot->hash);
+    slot->var.ap = found->ap;
+    slot->var.home = found->home;
+    __atomic_store_n (&slot->var.type, found->type, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock (&gslot_lock);
+}
+
 void Furlow_add_instruction (char *new) /* Add an instruction to the progm. */
 {
   size_t nsize;
@@ -99,6 +220,169 @@ Furlow_unlock_threads(void) /* Unlock threads. */
   pthread_mutex_unlock(&threads_lock);
 }
 
+void Furlow_add_thread (FACT_thread_t thread) /* Give a thread a slot in the table, and an ID. */
+{
+  size_t id, slot;
+  FACT_thread_t *chunk;
+
+  Furlow_lock_threads ();
+  if (num_free_ids != 0)
+    id = free_ids[--num_free_ids];
+  else {
+    if (thread_slots == ((size_t) 1 << THREAD_SLOT_BITS)) {
+      Furlow_unlock_threads ();
+      FACT_throw_error (CURR_THIS, "too many threads");
+    }
+    id = thread_slots++;
+    if (thread_chunks[id / THREAD_CHUNK_SIZE] == NULL) {
+      chunk = FACT_malloc (sizeof (FACT_thread_t) * THREAD_CHUNK_SIZE);
+      __atomic_store_n (&thread_chunks[id / THREAD_CHUNK_SIZE], chunk, __ATOMIC_RELEASE);
+    }
+  }
+
+  /* Other threads can find the thread as soon as it's stored, so it has
+   * to be set up by now.
+   */
+  slot = id & (((size_t) 1 << THREAD_SLOT_BITS) - 1);
+  thread->thread_num = id;
+  __atomic_store_n (&thread_chunks[slot / THREAD_CHUNK_SIZE][slot % THREAD_CHUNK_SIZE],
+		    thread, __ATOMIC_RELEASE);
+  num_threads++;
+  Furlow_unlock_threads ();
+}
+
+FACT_thread_t Furlow_find_thread (size_t id) /* Look up a thread by its ID, even if it has died. */
+{
+  size_t slot;
+  FACT_thread_t res, *chunk;
+
+  slot = id & (((size_t) 1 << THREAD_SLOT_BITS) - 1);
+  chunk = __atomic_load_n (&thread_chunks[slot / THREAD_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+  if (chunk == NULL)
+    return NULL;
+
+  res = __atomic_load_n (&chunk[slot % THREAD_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+  if (res == NULL || res->thread_num != id)
+    return NULL;
+
+  return res;
+}
+
+FACT_thread_t Furlow_get_thread (size_t id) /* Look up a live thread by its ID. */
+{
+  FACT_thread_t res;
+
+  res = Furlow_find_thread (id);
+  if (res == NULL || res->run_flag == T_DEAD)
+    return NULL;
+
+  return res;
+}
+
+bool Furlow_was_thread (size_t id) /* Check if an ID belonged to a thread that has since died. */
+{
+  size_t i, slot;
+  bool res;
+  FACT_thread_t occupant;
+
+  slot = id & (((size_t) 1 << THREAD_SLOT_BITS) - 1);
+  res = false;
+
+  /* An ID is from the past if it is older than the slot's current or
+   * next ID.
+   */
+  Furlow_lock_threads ();
+  if (slot < thread_slots) {
+    occupant = thread_chunks[slot / THREAD_CHUNK_SIZE][slot % THREAD_CHUNK_SIZE];
+    if (occupant != NULL)
+      res = id <= occupant->thread_num;
+    else {
+      for (i = 0; i < num_free_ids; i++) {
+	if ((free_ids[i] & (((size_t) 1 << THREAD_SLOT_BITS) - 1)) == slot)
+	  res = id < free_ids[i];
+      }
+    }
+  }
+  Furlow_unlock_threads ();
+
+  return res;
+}
+
+void Furlow_forget_thread (FACT_thread_t thread) /* Take a dead thread out of the table. */
+{
+  size_t slot;
+
+  slot = thread->thread_num & (((size_t) 1 << THREAD_SLOT_BITS) - 1);
+
+  Furlow_lock_threads ();
+  __atomic_store_n (&thread_chunks[slot / THREAD_CHUNK_SIZE][slot % THREAD_CHUNK_SIZE],
+		    NULL, __ATOMIC_RELEASE);
+  if (num_free_ids == free_ids_size) {
+    free_ids_size = (free_ids_size == 0) ? 16 : free_ids_size * 2;
+    free_ids = FACT_realloc (free_ids, sizeof (size_t) * free_ids_size);
+  }
+  free_ids[num_free_ids++] = thread->thread_num + ((size_t) 1 << THREAD_SLOT_BITS);
+  num_threads--;
+  Furlow_unlock_threads ();
+}
+
+void Furlow_remove_thread (FACT_thread_t thread) /* Free a dead thread's stacks. */
+{
+  /* A joinable thread keeps its slot, and so its result, until it has
+   * been joined.
+   */
+  if (!thread->joinable)
+    Furlow_forget_thread (thread);
+
+  /* Release the stacks now. The message queue is left, since a sender
+   * may have found the thread before it died. The rest goes to the
+   * collector once nothing points to the thread.
+   */
+  FACT_free (thread->vstack);
+  FACT_free (thread->cstack);
+  FACT_free (thread->traps);
+  FACT_free (thread->icache);
+  thread->vstack = thread->vstackp = NULL;
+  thread->cstack = thread->cstackp = NULL;
+  thread->traps = NULL;
+  thread->icache = NULL;
+  thread->vstack_size = thread->cstack_size = thread->num_traps = thread->icache_size = 0;
+  thread->frame_pool = NULL;
+  thread->frame_pool_size = 0;
+  memset (thread->registers, 0, sizeof (thread->registers));
+}
+
+static void init_thread (FACT_thread_t thread) /* Set up the stacks and queue of a zeroed thread. */
+{
+  int i;
+
+  thread->curr_err.what = DEF_ERR_MSG;
+  thread->cstack_size = 1;
+  thread->cstackp = thread->cstack = FACT_malloc (sizeof (struct cstack_t));
+  FACT_init_messages (thread);
+  pthread_mutex_init (&thread->join_lock, NULL);
+  pthread_cond_init (&thread->join_block, NULL);
+
+  for (i = 0; i < T_REGISTERS; i++)
+    thread->registers[i].type = UNSET_TYPE;
+}
+
+FACT_thread_t Furlow_new_thread (size_t ip) /* Allocate a thread that starts at ip, and give it an ID. */
+{
+  FACT_thread_t res;
+
+  res = FACT_malloc (sizeof (struct FACT_thread));
+  init_thread (res);
+
+  /* Set the top scope and the IP of the thread. */
+  THIS_OF (res) = FACT_alloc_scope ();
+  THIS_OF (res)->name = "main<thread>";
+  IP_OF (res) = ip;
+
+  Furlow_add_thread (res);
+  return res;
+}
+
 inline size_t
 Furlow_offset(void) /* Get the instruction offset. */
 {
@@ -258,7 +542,7 @@ FACT_t *Furlow_register (int reg_number) /* Access a Furlow machine register. */
     curr_thread->registers[R_TID].ap = FACT_alloc_num ();
   }
   mpc_set_ui (((FACT_num_t) curr_thread->registers[R_TID].ap)->value,
-	      curr_thread - threads);
+	      curr_thread->thread_num);
   /* Fall through. */
 
  h_rGEN:
@@ -281,7 +565,7 @@ FACT_t *Furlow_register (int reg_number) /* Access a Furlow machine register. */
       curr_thread->registers[R_TID].ap = FACT_alloc_num ();
     }
     mpc_set_ui (((FACT_num_t) curr_thread->registers[R_TID].ap)->value,
-		curr_thread - threads);
+		curr_thread->thread_num);
     break;
     
   default:
@@ -311,9 +595,9 @@ void *Furlow_reg_val (int reg_number, FACT_type des) /* Safely access a register
 
 void Furlow_run () /* Run the program until a HALT is reached. */ 
 {
-  int i;
   char *hold_name;
   size_t tnum;
+  size_t budget;
   FACT_thread_t next;
   struct cstack_t cs_arg;
   register FACT_t args[4];      /* Maximum of three arguments plus the result per opcode. */
@@ -336,15 +620,18 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     ENTRY (DEC),
     ENTRY (DEF_N),
     ENTRY (DEF_S),
+    ENTRY (DEF_T),
     ENTRY (DIE),
     ENTRY (DIV),
     ENTRY (DROP),
     ENTRY (DUP),
     ENTRY (ELEM),
+    ENTRY (ELEMS),
     ENTRY (EXIT),
     ENTRY (GLOBAL),
     ENTRY (GOTO),
     /* ENTRY (GROUP), */
+    ENTRY (GVAR),
     ENTRY (HALT),
     ENTRY (INC),
     ENTRY (IOR),
@@ -359,6 +646,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     ENTRY (LAMBDA),
     ENTRY (LOCK),
     ENTRY (MOD),
+    ENTRY (MOVE),
     ENTRY (MUL),
     ENTRY (NAME),
     ENTRY (NEG),
@@ -368,15 +656,21 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     ENTRY (PURGE),
     ENTRY (REF),
     ENTRY (RET),
+    ENTRY (RET_F),
     ENTRY (SET_C),
     ENTRY (SET_F),
+    ENTRY (SET_U),
     ENTRY (SPRT),
     ENTRY (STO),
+    ENTRY (STR),
     ENTRY (SUB),
     ENTRY (SWAP),
+    ENTRY (TCALL),
+    ENTRY (TCALL_F),
     ENTRY (THIS),
     ENTRY (TRAP_B),
     ENTRY (TRAP_E),
+    ENTRY (UP),
     ENTRY (USE),
     ENTRY (VAR),
     ENTRY (VA_ADD),
@@ -388,16 +682,39 @@ void Furlow_run () /* Run the program until a HALT is reached. */
 #define END_SEG() do { goto *inst_jump_table[progm[++CURR_IP][0]]; } while (0)
 #define NEXT_INST() END_SEG()
 
+/* Tasks are never preempted, so loops give up the worker every so often. */
+#define YIELD_BUDGET 4096
+#define SPEND_BUDGET()					\
+  do {							\
+    if (--budget == 0) {				\
+      budget = YIELD_BUDGET;				\
+      FACT_sched_yield ();				\
+    }							\
+  } while (0)
+
+/* Jump to an address, counting backward jumps towards the budget. */
+#define JUMP_TO(a)					\
+  do {							\
+    tnum = (a);						\
+    if (tnum <= CURR_IP)				\
+      SPEND_BUDGET ();					\
+    CURR_IP = tnum - 1;					\
+  } while (0)
+
+/* Numbers boxed from typed arrays have to be written back when changed. */
+#define SYNC_NUM(v) do { if (FACT_cast_to_num (v)->owner != NULL) FACT_sync_num ((v).ap); } while (0)
+
   curr_thread->run_flag = T_LIVE; /* The thread is now live. */
+  budget = YIELD_BUDGET;
   
  eval:
   /* Set the error handler. */
-  if (setjmp (handle_err)) {
+  if (setjmp (curr_thread->handle_err)) {
     /* An error has been caught. If there are no available traps, jump to
      * recover. Otherwise, set the ip to the current trap handler.
      */
     if (curr_thread->num_traps == 0)
-      longjmp (recover, 1);
+      longjmp (curr_thread->recover, 1);
     
     /* Destroy the unecessary stacks and set the ip. */
     while ((curr_thread->cstackp - curr_thread->cstack + 1)
@@ -406,6 +723,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     
     CURR_IP = curr_thread->traps[curr_thread->num_traps - 1][0];
     curr_thread->run_flag = T_LIVE;
+    budget = YIELD_BUDGET; /* Locals are unreliable after a longjmp. */
     goto eval; /* Go back to eval to reset the error handler. */
   }
 
@@ -427,6 +745,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     mpc_add (((FACT_num_t) args[2].ap)->value,
 	     ((FACT_num_t) args[1].ap)->value,
 	     ((FACT_num_t) args[0].ap)->value);
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
     
@@ -443,6 +762,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     mpc_and (((FACT_num_t) args[2].ap)->value,
 	     ((FACT_num_t) args[1].ap)->value,
 	     ((FACT_num_t) args[0].ap)->value);
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
     
@@ -453,7 +773,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     if (args[1].type == NUM_TYPE) {
       if (args[0].type == SCOPE_TYPE)
 	FACT_throw_error (CURR_THIS, "cannot append a scope to a number");
-      FACT_append_num (args[1].ap, args[0].ap);
+      FACT_append_num (args[1].ap, args[0].ap, false);
     } else {
       if (args[0].type == NUM_TYPE)
 	FACT_throw_error (CURR_THIS, "cannot append a number to a scope");
@@ -461,7 +781,8 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     }
   }
   END_SEG ();
-    
+
+   
   SEG (CALL);
   {
     args[0].ap = Furlow_reg_val (progm[CURR_IP][1], SCOPE_TYPE);
@@ -490,9 +811,10 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     if (FACT_cast_to_num (args[2])->locked)
       FACT_throw_error (CURR_THIS, "cannot set immutable variable");
     mpc_set_ui (FACT_cast_to_num (args[2])->value,
-		(FACT_compare_num (args[1].ap, args[0].ap) == 0
+		(FACT_equal_num (args[1].ap, args[0].ap)
 		 ? 1
 		 : 0));
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
     
@@ -507,6 +829,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
 		(FACT_compare_num (args[1].ap, args[0].ap) <= 0
 		 ? 1
 		 : 0));
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
       
@@ -521,6 +844,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
 		(FACT_compare_num (args[1].ap, args[0].ap) < 0
 		 ? 1
 		 : 0));
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
       
@@ -535,6 +859,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
 		(FACT_compare_num (args[1].ap, args[0].ap) >= 0
 		 ? 1
 		 : 0));
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
 
@@ -549,6 +874,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
 		(FACT_compare_num (args[1].ap, args[0].ap) > 0
 		 ? 1
 		 : 0));
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
 	  
@@ -560,9 +886,10 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     if (FACT_cast_to_num (args[2])->locked)
       FACT_throw_error (CURR_THIS, "cannot set immutable variable");
     mpc_set_ui (FACT_cast_to_num (args[2])->value,
-		(FACT_compare_num (args[1].ap, args[0].ap) != 0
-		 ? 1
-		 : 0));
+		(FACT_equal_num (args[1].ap, args[0].ap)
+		 ? 0
+		 : 1));
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
 
@@ -592,6 +919,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
       FACT_throw_error (CURR_THIS, "cannot set immutable variable");
     mpc_sub_ui (FACT_cast_to_num (args[0])->value,
 		FACT_cast_to_num (args[0])->value, 1);
+    SYNC_NUM (args[0]);
   }
   END_SEG ();
 
@@ -608,6 +936,13 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     FACT_def_scope (progm[CURR_IP] + 1, false);
   }
   END_SEG ();
+
+  SEG (DEF_T);
+  {
+    /* Declare a typed number array. */
+    FACT_def_typed (progm[CURR_IP] + 1, get_seg_addr (progm[CURR_IP] + 2));
+  }
+  END_SEG ();
   
   SEG (DIE);
   {
@@ -628,6 +963,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     mpc_div (((FACT_num_t) args[2].ap)->value,
 	     ((FACT_num_t) args[1].ap)->value,
 	     ((FACT_num_t) args[0].ap)->value);
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
 
@@ -667,6 +1003,26 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   }
   END_SEG ();
 
+  SEG (ELEMS);
+  {
+    size_t i, n;
+    
+    /* Get an element of a multi-dimensional array. The indices are on
+     * the stack, the first dimension's on top.
+     */
+    args[0] = *Furlow_register (progm[CURR_IP][1]);
+    n = get_seg_addr (progm[CURR_IP] + 2);
+    for (i = 0; i < n; i++) {
+      args[1].ap = Furlow_reg_val (R_POP, NUM_TYPE);
+      if (args[0].type == NUM_TYPE)
+	args[0].ap = FACT_index_num (args[0].ap, args[1].ap);
+      else
+	args[0].ap = FACT_index_scope (args[0].ap, args[1].ap);
+    }
+    push_v (args[0]);
+  }
+  END_SEG ();
+
   SEG (EXIT);
   {
     /* Close any open trap regions. */
@@ -680,6 +1036,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     CURR_IP = cs_arg.ip;
     args[0].ap = cs_arg.this;
     args[0].type = SCOPE_TYPE;
+    args[0].home = NULL;
     push_v (args[0]);
   }
   END_SEG ();
@@ -687,13 +1044,14 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   SEG (GLOBAL);
   {
     args[0] = *Furlow_register (progm[CURR_IP][1]);
-    if (progm[CURR_IP][2] != '\0') {
+    hold_name = Furlow_sym_arg (progm[CURR_IP] + 2);
+    if (*hold_name != '\0') {
       if (args[0].type == NUM_TYPE)
-	FACT_cast_to_num (args[0])->name = progm[CURR_IP] + 2;
+	FACT_cast_to_num (args[0])->name = hold_name;
       else
-	FACT_cast_to_scope (args[0])->name = progm[CURR_IP] + 2;
+	FACT_cast_to_scope (args[0])->name = hold_name;
     }
-    FACT_add_to_table (&Furlow_globals, args[0]);
+    Furlow_bind_global (args[0]);
   }
   END_SEG ();
     
@@ -704,6 +1062,20 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   }
   END_SEG ();
 
+  SEG (GVAR);
+  {
+    /* Push a constant global directly from its slot, unless the constant
+     * has not been defined yet or a scope we're in shadows it.
+     */
+    tnum = get_seg_addr (progm[CURR_IP] + 1);
+    if (__atomic_load_n (&GSLOT (tnum)->var.type, __ATOMIC_ACQUIRE) == UNSET_TYPE
+	|| is_shadowed (GSLOT (tnum)))
+      FACT_get_var (Furlow_sym_arg (progm[CURR_IP] + 5), get_icache ());
+    else
+      push_v (GSLOT (tnum)->var);
+  }
+  END_SEG ();
+
   SEG (HALT);
   {
     curr_thread->run_flag = T_HALTED; /* The thread is dead, for now. */
@@ -719,6 +1091,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
       FACT_throw_error (CURR_THIS, "cannot set immutable variable");
     mpc_add_ui (FACT_cast_to_num (args[0])->value,
 		FACT_cast_to_num (args[0])->value, 1);
+    SYNC_NUM (args[0]);
   }
   END_SEG ();
 
@@ -738,30 +1111,39 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     mpc_ior (((FACT_num_t) args[2].ap)->value,
 	     ((FACT_num_t) args[1].ap)->value,
 	     ((FACT_num_t) args[0].ap)->value);
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
 	
 
   SEG (IS_AUTO);
   {
-    push_constant_ui (FACT_get_local (CURR_THIS, progm[CURR_IP] + 1) == NULL
-		      ? 0
-		      : 1);
+    hold_name = Furlow_sym_arg (progm[CURR_IP] + 1);
+    if (hold_name == FACT_SYM ("up"))
+      push_constant_ui (CURR_THIS->up == NULL ? 0 : 1);
+    else
+      push_constant_ui (FACT_get_local_cached (CURR_THIS, hold_name, get_icache ()) == NULL
+			? 0
+			: 1);
   }
   END_SEG ();
 
   SEG (IS_DEF);
   {
-    push_constant_ui (FACT_get_global (CURR_THIS, progm[CURR_IP] + 1) == NULL
-		      ? 0
-		      : 1);
+    hold_name = Furlow_sym_arg (progm[CURR_IP] + 1);
+    if (hold_name == FACT_SYM ("up"))
+      push_constant_ui (CURR_THIS->up == NULL ? 0 : 1);
+    else
+      push_constant_ui (FACT_get_global_cached (CURR_THIS, hold_name, get_icache ()) == NULL
+			? 0
+			: 1);
   }
   END_SEG ();
 
   SEG (JMP);
   {
     /* Unconditional jump. */
-    CURR_IP = get_seg_addr (progm[CURR_IP] + 1) - 1;
+    JUMP_TO (get_seg_addr (progm[CURR_IP] + 1));
   }
   END_SEG ();
 
@@ -771,6 +1153,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     args[0].ap = FACT_alloc_scope ();
     *FACT_cast_to_scope (args[0])->code = get_seg_addr (progm[CURR_IP] + 1);
     args[0].type = SCOPE_TYPE;
+    args[0].home = NULL;
     push_v (args[0]);
   }
   END_SEG ();
@@ -780,7 +1163,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     /* Jump on false. */
     args[0].ap = Furlow_reg_val (progm[CURR_IP][1], NUM_TYPE);
     if (!mpc_cmp_ui (((FACT_num_t) args[0].ap)->value, 0))
-      CURR_IP = get_seg_addr (progm[CURR_IP] + 2) - 1;
+      JUMP_TO (get_seg_addr (progm[CURR_IP] + 2));
   }
   END_SEG ();
 
@@ -807,15 +1190,22 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     /* Jump on true. */
     args[0].ap = Furlow_reg_val (progm[CURR_IP][1], NUM_TYPE);
     if (mpc_cmp_ui (((FACT_num_t) args[0].ap)->value, 0))
-      CURR_IP = get_seg_addr (progm[CURR_IP] + 2) - 1;
+      JUMP_TO (get_seg_addr (progm[CURR_IP] + 2));
   }
   END_SEG ();
 
   SEG (LAMBDA);
   {
-    /* Push a lambda scope to the stack. */
-    args[0].ap = FACT_alloc_scope ();
+    /* Push a lambda scope to the stack, reusing a recycled frame if we can. */
+    if (curr_thread->frame_pool != NULL) {
+      args[0].ap = curr_thread->frame_pool;
+      curr_thread->frame_pool = curr_thread->frame_pool->caller;
+      FACT_cast_to_scope (args[0])->caller = NULL;
+      curr_thread->frame_pool_size--;
+    } else
+      args[0].ap = FACT_alloc_scope ();
     args[0].type = SCOPE_TYPE;
+    args[0].home = NULL;
     push_v (args[0]);
   }
   END_SEG ();
@@ -845,6 +1235,26 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     mpc_mod (((FACT_num_t) args[2].ap)->value,
 	     ((FACT_num_t) args[1].ap)->value,
 	     ((FACT_num_t) args[0].ap)->value);
+    SYNC_NUM (args[2]);
+  }
+  END_SEG ();
+
+  SEG (MOVE);
+  {
+    /* APPEND, where the compiler has proven that the variable being
+     * appended is a temporary, so it is put in the array as is.
+     */
+    args[0] = *Furlow_register (progm[CURR_IP][1]);
+    args[1] = *Furlow_register (progm[CURR_IP][2]);
+    if (args[1].type == NUM_TYPE) {
+      if (args[0].type == SCOPE_TYPE)
+	FACT_throw_error (CURR_THIS, "cannot append a scope to a number");
+      FACT_append_num (args[1].ap, args[0].ap, true);
+    } else {
+      if (args[0].type == NUM_TYPE)
+	FACT_throw_error (CURR_THIS, "cannot append a number to a scope");
+      FACT_append_scope (args[1].ap, args[0].ap);
+    }
   }
   END_SEG ();
 
@@ -858,6 +1268,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     mpc_mul (((FACT_num_t) args[2].ap)->value,
 	     ((FACT_num_t) args[1].ap)->value,
 	     ((FACT_num_t) args[0].ap)->value);
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
 
@@ -876,6 +1287,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
       FACT_throw_error (CURR_THIS, "cannot set immutable variable");
     mpc_neg (FACT_cast_to_num (args[0])->value,
 	     FACT_cast_to_num (args[0])->value);
+    SYNC_NUM (args[0]);
   }
   END_SEG ();
 
@@ -933,6 +1345,20 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   }
   END_SEG ();
 
+  SEG (RET_F);
+  {
+    /* Same as RET, but the compiler has proven that nothing can reference
+     * the function's frame after it returns, so it is recycled.
+     */
+    while (curr_thread->num_traps != 0
+	   && (curr_thread->traps[curr_thread->num_traps][1]
+	       == (curr_thread->cstackp - curr_thread->cstack + 1)))
+      pop_t ();
+    cs_arg = pop_c ();
+    recycle_frame (cs_arg.this);
+  }
+  END_SEG ();
+
   SEG (SET_C);
   {
     args[0].ap = Furlow_reg_val (progm[CURR_IP][1], SCOPE_TYPE);
@@ -949,43 +1375,30 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   }
   END_SEG ();
 
+  SEG (SET_U);
+  {
+    /* SET_U,$A,$B : $A's up <- $B */
+    args[0].ap = Furlow_reg_val (progm[CURR_IP][1], SCOPE_TYPE);
+    args[1].ap = Furlow_reg_val (progm[CURR_IP][2], SCOPE_TYPE);
+    args[2].ap = FACT_cast_to_scope (args[0])->up;
+    FACT_cast_to_scope (args[0])->up = args[1].ap;
+    if (FACT_is_circular (args[0].ap)) { /* Circular scope link. */
+      FACT_cast_to_scope (args[0])->up = args[2].ap;
+      FACT_throw_error (CURR_THIS, "assignment makes circularly linked scopes");
+    }
+  }
+  END_SEG ();
+
   SEG (SPRT);
   {
     FACT_thread_t curr;
 
-    /* Gain control of threads. */
-    Furlow_lock_threads ();
-
-    /* Find the next open spot in the linked list. */
-    for (curr = threads; curr->next != NULL; curr = curr->next);
-
-    /* Allocate and initialize the new thread. */
-    curr->next = FACT_malloc (sizeof (struct FACT_thread));
-    curr = curr->next;
-    curr->thread_num = num_threads++;
-    curr->curr_err.what = DEF_ERR_MSG;
-    curr->cstack_size = 1;
-    curr->cstackp = curr->cstack = FACT_malloc (sizeof (struct cstack_t));
-    curr->root_message = NULL;
-    curr->num_messages = 0;
-    pthread_mutex_init (&curr->queue_lock, NULL);
-    pthread_cond_init (&curr->msg_block, NULL);
-	
-    /* Set the top scope and the IP of the thread. */
-    THIS_OF (curr) = FACT_alloc_scope ();
-    THIS_OF (curr)->name = "main<thread>";
-    IP_OF (curr) = CURR_IP + 1;
-
-    /* Initialize the registers. */
-    for (i = 0; i < T_REGISTERS; i++)
-      curr->registers[i].type = UNSET_TYPE;
-
-    /* Push the TID of the new thread to the var stack. */
+    /* Create the thread, and push its ID to the var stack. */
+    curr = Furlow_new_thread (CURR_IP + 1);
     push_constant_ui (curr->thread_num);
 	
-    /* Run the thread and give up control of threads. */
-    pthread_create (&curr->thread_id, NULL, Furlow_thread_mask, curr);
-    Furlow_unlock_threads ();
+    /* Run the thread. */
+    FACT_sched_spawn (curr);
 
     /* Jump. */
     CURR_IP = get_seg_addr (progm[CURR_IP] + 1) - 1;
@@ -996,7 +1409,8 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   {
     /* STO,$A,$B : $B <- $A */
     args[0] = *Furlow_register (progm[CURR_IP][1]);
-    args[1] = *Furlow_register (progm[CURR_IP][2]);
+    reg_args[1] = Furlow_register (progm[CURR_IP][2]);
+    args[1] = *reg_args[1];
 
     if (args[0].type == UNSET_TYPE || args[1].type == UNSET_TYPE) 
       FACT_throw_error (CURR_THIS, "unset value encountered");
@@ -1007,26 +1421,40 @@ void Furlow_run () /* Run the program until a HALT is reached. */
       if (FACT_cast_to_num (args[1])->locked)
 	FACT_throw_error (CURR_THIS, "cannot set immutable variable");
       FACT_set_num (args[1].ap, args[0].ap);
+      SYNC_NUM (args[1]);
     } else {
+      FACT_t *slot;
       struct FACT_scope temp[1];
-      
+
       if (args[0].type == NUM_TYPE)
 	FACT_throw_error (CURR_THIS, "cannot set a scope to a number");
       if (FACT_cast_to_scope (args[1])->lock_stat == HARD_LOCK)
 	FACT_throw_error (CURR_THIS, "cannot set immutable variable");
 
       hold_name = ((FACT_scope_t) args[1].ap)->name;
-      if (hold_name != NULL && !strcmp ("up", hold_name)) { /* We're setting the up scope. */
+      slot = (args[1].home != NULL
+	      ? FACT_find_in_table_nohash (args[1].home, hold_name)
+	      : NULL);
+      if (slot != NULL && slot->ap == args[1].ap) {
+	/* Scopes defined in the variable's old value point to it as their
+	 * up, so give the variable a new scope instead of overwriting it.
+	 */
+	args[1].ap = FACT_malloc (sizeof (struct FACT_scope));
+	memcpy (args[1].ap, args[0].ap, sizeof (struct FACT_scope));
+	((FACT_scope_t) args[1].ap)->name = hold_name;
+	slot->ap = reg_args[1]->ap = args[1].ap;
+      } else {
+	/* Array elements and anonymous scopes have no slot to replace, so
+	 * they are overwritten. The copied up link can then point back at
+	 * the destination, as in a[0] = a[0]:b.
+	 */
 	memcpy (temp, args[1].ap, sizeof (struct FACT_scope));
 	memcpy (args[1].ap, args[0].ap, sizeof (struct FACT_scope));
 	((FACT_scope_t) args[1].ap)->name = hold_name;
-	if (FACT_is_circular (args[1].ap)) { /* Circular scope link. */
+	if (FACT_is_circular (args[1].ap)) {
 	  memcpy (args[1].ap, temp, sizeof (struct FACT_scope));
 	  FACT_throw_error (CURR_THIS, "assignment makes circularly linked scopes");
 	}
-      } else {
-	memcpy (args[1].ap, args[0].ap, sizeof (struct FACT_scope));
-	((FACT_scope_t) args[1].ap)->name = hold_name;
       }
 
       if (FACT_cast_to_scope (args[1])->lock_stat == HARD_LOCK)
@@ -1035,6 +1463,14 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   }
   END_SEG ();
 
+  SEG (STR);
+  {
+    args[0].ap = FACT_stona (progm[CURR_IP] + 1);
+    args[0].type = NUM_TYPE;
+    push_v (args[0]);
+  }
+  END_SEG ();
+
   SEG (SUB);
   {
     args[0].ap = Furlow_reg_val (progm[CURR_IP][1], NUM_TYPE);
@@ -1045,6 +1481,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     mpc_sub (((FACT_num_t) args[2].ap)->value,
 	     ((FACT_num_t) args[1].ap)->value,
 	     ((FACT_num_t) args[0].ap)->value);
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
 
@@ -1064,10 +1501,53 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   }
   END_SEG ();
 
+  SEG (TCALL_F);
+  {
+    /* TCALL for a frame that can't escape, like RET_F. TCALL checks the
+     * opcode and recycles the frame.
+     */
+    goto INST_TCALL;
+  }
+  END_SEG ();
+
+  SEG (TCALL);
+  {
+    /* Call a function in place of the current one, so that it returns
+     * straight to our caller.
+     */
+    args[0].ap = Furlow_reg_val (progm[CURR_IP][1], SCOPE_TYPE);
+
+    if (FACT_cast_to_scope (args[0])->extrn_func != NULL) {
+      /* Builtins return right away, so just call them like CALL. The
+       * instruction after this one will then return.
+       */
+      push_c (*(FACT_cast_to_scope (args[0])->code) - 1, args[0].ap);
+      FACT_cast_to_scope (args[0])->extrn_func ();
+      while (curr_thread->num_traps != 0
+	     && curr_thread->traps[curr_thread->num_traps][1] == curr_thread->cstack_size)
+	pop_t ();
+      pop_c ();
+      NEXT_INST ();
+    }
+
+    while (curr_thread->num_traps != 0
+	   && (curr_thread->traps[curr_thread->num_traps][1]
+	       == (curr_thread->cstackp - curr_thread->cstack + 1)))
+      pop_t ();
+    cs_arg = pop_c ();
+    if (progm[CURR_IP][0] == TCALL_F)
+      recycle_frame (cs_arg.this);
+    push_c (*(FACT_cast_to_scope (args[0])->code) - 1, args[0].ap);
+    /* A tail call can loop forever without jumping back. */
+    SPEND_BUDGET ();
+  }
+  END_SEG ();
+
   SEG (THIS);
   {
     args[0].ap = CURR_THIS;
     args[0].type = SCOPE_TYPE;
+    args[0].home = NULL;
     push_v (args[0]);
   }
   END_SEG ();
@@ -1087,6 +1567,18 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   }
   END_SEG ();
 
+  SEG (UP);
+  {
+    /* up is a virtual member, the link to the scope above. */
+    if (CURR_THIS->up == NULL)
+      FACT_throw_error (CURR_THIS, "undefined variable: up");
+    args[0].ap = CURR_THIS->up;
+    args[0].type = SCOPE_TYPE;
+    args[0].home = NULL;
+    push_v (args[0]);
+  }
+  END_SEG ();
+
   SEG (USE);
   {
     args[0].ap = Furlow_reg_val (progm[CURR_IP][1], SCOPE_TYPE);
@@ -1097,7 +1589,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
   SEG (VAR);
   {
     /* Load a variable. */
-    FACT_get_var (progm[CURR_IP] + 1);
+    FACT_get_var (Furlow_sym_arg (progm[CURR_IP] + 1), get_icache ());
   }
   END_SEG ();
 
@@ -1139,6 +1631,7 @@ void Furlow_run () /* Run the program until a HALT is reached. */
     mpc_xor (((FACT_num_t) args[2].ap)->value,
 	     ((FACT_num_t) args[1].ap)->value,
 	     ((FACT_num_t) args[0].ap)->value);
+    SYNC_NUM (args[2]);
   }
   END_SEG ();
 }
@@ -1155,12 +1648,59 @@ static inline size_t get_seg_addr (char *arg) /* Convert a segment address to a
   return n;
 }
 
+static inline struct FACT_icache *get_icache (void) /* Get the current instruction's inline cache. */
+{
+  size_t nsize;
+
+  if (CURR_IP >= curr_thread->icache_size) {
+    /* The program has grown since the caches were last allocated. */
+    nsize = Furlow_offset () + 1;
+    curr_thread->icache = FACT_realloc (curr_thread->icache,
+					sizeof (struct FACT_icache) * nsize);
+    memset (curr_thread->icache + curr_thread->icache_size, 0,
+	    sizeof (struct FACT_icache) * (nsize - curr_thread->icache_size));
+    curr_thread->icache_size = nsize;
+  }
+
+  return curr_thread->icache + CURR_IP;
+}
+
+static inline bool is_shadowed (struct Furlow_gslot *slot) /* Check if a scope on the way up defines a global's name. */
+{
+  uint64_t bit;
+  FACT_scope_t env;
+
+  /* Search the scopes like FACT_get_global, where the bloom filters rule
+   * out nearly all of them without a lookup.
+   */
+  bit = FACT_bloom_bit (slot->hash);
+  for (env = CURR_THIS; env != NULL && env->lock_stat == UNLOCKED; env = env->up) {
+    if ((env->vars->bloom & bit)
+	&& FACT_find_in_table (env->vars, slot->name, slot->hash) != NULL)
+      return true;
+  }
+
+  return false;
+}
+
+static inline void recycle_frame (FACT_scope_t frame) /* Put a returned frame in the thread's pool. */
+{
+  if (curr_thread->frame_pool_size < MAX_FRAME_POOL) {
+    FACT_recycle_scope (frame);
+    frame->caller = curr_thread->frame_pool;
+    curr_thread->frame_pool = frame;
+    curr_thread->frame_pool_size++;
+  }
+}
+
 void *Furlow_thread_mask (void *new_thread)
 {
   struct cstack_t frame;
   
   /* Set the recover jmp buffer. */
-  if (setjmp (recover)) {
+  curr_thread = new_thread;
+  if (setjmp (curr_thread->recover)) {
+    curr_thread->failed = true;
 #ifdef DEBUG
     /* Print out the error and a stack trace. */
     fprintf (stderr, "Caught unhandled error: %s\n", curr_thread->curr_err.what);
@@ -1169,14 +1709,85 @@ void *Furlow_thread_mask (void *new_thread)
       fprintf (stderr, "\tat scope %s (%s:%zu)\n", frame.this->name, FACT_get_file (frame.ip), FACT_get_line (frame.ip));
     }
 #endif /* DEBUG */
-  }  else {
-    /* Set curr_thread to new_thread and run the VM. */
-    curr_thread = new_thread;
+  }  else if (curr_thread->entry != NULL) {
+    /* Tasks started from C have no Furlow_run to catch their errors. */
+    if (setjmp (curr_thread->handle_err))
+      longjmp (curr_thread->recover, 1);
+    curr_thread->entry (curr_thread->entry_arg);
+  } else {
+    /* Run the VM. */
     Furlow_run ();
   }
   return NULL;
 }
 
+FACT_t Furlow_call (FACT_scope_t func, FACT_t *argv, size_t argc) /* Call a function on the current thread. */
+{
+  size_t i, depth, num_traps;
+  size_t (*traps)[2];
+  jmp_buf hold_err, hold_recover;
+  FACT_scope_t frame;
+
+  /* The callee runs in a Furlow_run of its own, which replaces the error
+   * handler. Its traps must not see the caller's either. Anything that
+   * gets past the callee is caught here and thrown again to the caller.
+   */
+  depth = curr_thread->cstackp - curr_thread->cstack;
+  traps = curr_thread->traps;
+  num_traps = curr_thread->num_traps;
+  memcpy (hold_err, curr_thread->handle_err, sizeof (jmp_buf));
+  memcpy (hold_recover, curr_thread->recover, sizeof (jmp_buf));
+  curr_thread->traps = NULL;
+  curr_thread->num_traps = 0;
+
+  if (setjmp (curr_thread->recover)) {
+    while (curr_thread->cstackp - curr_thread->cstack > depth)
+      pop_c ();
+    curr_thread->traps = traps;
+    curr_thread->num_traps = num_traps;
+    memcpy (curr_thread->handle_err, hold_err, sizeof (jmp_buf));
+    memcpy (curr_thread->recover, hold_recover, sizeof (jmp_buf));
+    curr_thread->run_flag = T_LIVE;
+    longjmp (curr_thread->handle_err, 1);
+  }
+
+  for (i = 0; i < argc; i++)
+    push_v (argv[i]);
+
+  if (func->extrn_func != NULL) {
+    /* BIFs are called directly, the same way CALL does. */
+    push_c (0, func);
+    func->extrn_func ();
+    pop_c ();
+  } else {
+    /* Make the frame the same way LAMBDA, SET_U and SET_F do. */
+    if (curr_thread->frame_pool != NULL) {
+      frame = curr_thread->frame_pool;
+      curr_thread->frame_pool = frame->caller;
+      frame->caller = NULL;
+      curr_thread->frame_pool_size--;
+    } else
+      frame = FACT_alloc_scope ();
+    frame->up = func;
+    frame->code = func->code;
+    frame->name = func->name;
+
+    /* Return to the reserved HALT, which ends the nested run. */
+    push_c (CALL_RET_ADDR - 1, CURR_THIS);
+    push_c (*func->code, frame);
+    Furlow_run ();
+    pop_c ();
+  }
+
+  curr_thread->traps = traps;
+  curr_thread->num_traps = num_traps;
+  memcpy (curr_thread->handle_err, hold_err, sizeof (jmp_buf));
+  memcpy (curr_thread->recover, hold_recover, sizeof (jmp_buf));
+  curr_thread->run_flag = T_LIVE;
+
+  return pop_v ();
+}
+
 inline void push_constant_str (char *cval) /* Push a constant number to the var stack. */
 {
   /* TODO: add caching, maybe */
@@ -1222,25 +1833,21 @@ inline void push_constant_si (signed long int n)
 
 void Furlow_init_vm (void) /* Create the main scope and thread. */
 {
-  int i;
+  static char reserved[2][1] = { { NOP }, { HALT } };
   
-  curr_thread = threads = FACT_malloc (sizeof (struct FACT_thread));
-  memset (threads, 0, sizeof (struct FACT_thread));
-  num_threads = 1;
-  threads->cstack_size++;
-  threads->cstackp = threads->cstack = FACT_malloc (sizeof (struct cstack_t));
-  threads->curr_err.what = DEF_ERR_MSG;
-  threads->next = NULL;
-  threads->root_message = NULL;
-  threads->num_messages = 0;
-  pthread_mutex_init (&threads->queue_lock, NULL);
-  pthread_cond_init (&threads->msg_block, NULL);
+  curr_thread = FACT_malloc (sizeof (struct FACT_thread));
+  memset (curr_thread, 0, sizeof (struct FACT_thread));
+  init_thread (curr_thread);
   CURR_THIS = FACT_alloc_scope ();
   CURR_THIS->name = "main";
-  CURR_IP = 0;
 
-  for (i = 0; i < T_REGISTERS; i++)
-    threads->registers[i].type = UNSET_TYPE;
+  /* The program starts after the instructions reserved for Furlow_call. */
+  Furlow_add_instruction (reserved[0]);
+  Furlow_add_instruction (reserved[1]);
+  CURR_IP = Furlow_offset ();
+
+  /* The main thread is always thread 0. */
+  Furlow_add_thread (curr_thread);
 }
 
 void Furlow_destroy_vm (void) /* Deallocate everything and destroy every thread. */
@@ -1259,7 +1866,8 @@ void Furlow_disassemble (void) /* Print the byte code currently loaded into the
   if (progm == NULL)
     goto end;
 
-  for (i = 0; (inst = progm[i][0]) != HALT; i++) {
+  for (i = 0; i < Furlow_offset (); i++) {
+    inst = progm[i][0];
     /* print out the instruction and address. */
     printf ("%zu:\t%s", i, Furlow_instructions[inst].token);
     for (j = 0, ofs = 1; Furlow_instructions[inst].args[j] != 0; j++) {
@@ -1273,6 +1881,11 @@ void Furlow_disassemble (void) /* Print the byte code currently loaded into the
 	printf (", $%s", progm[i] + ofs);
 	ofs += strlen (progm[i] + ofs);
 	break;
+
+      case 'n': /* Symbol. */
+	printf (", $%s", Furlow_sym_arg (progm[i] + ofs));
+	ofs += sizeof (char *);
+	break;
 	
       case 'a': /* Address. */
 	printf (", @%zu", get_seg_addr (progm[i] + ofs));
@@ -1296,12 +1909,12 @@ static void print_num (FACT_num_t val)
 
   if (val->name != NULL)
     printf ("%s", val->name);
-  if (val->array_up != NULL) {
+  if (val->array_size != 0) {
     printf (" [");
     for (i = 0; i < val->array_size; i++) {
       if (i)
 	printf (", ");
-      print_num (val->array_up[i]);
+      print_num (FACT_get_elem (val, i));
     }
     printf (" ]");
   } else
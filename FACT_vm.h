@@ -21,7 +21,9 @@
 #include "FACT_types.h"
 
 #include <setjmp.h>
+#include <string.h>
 #include <pthread.h>
+#include <ucontext.h>
 
 /* Register specifications:                                   */
 #define T_REGISTERS 256 /* Total number of registers (G + S). */
@@ -51,6 +53,7 @@ struct cstack_t {
 };
 
 #define CYCLES_ON_COLLECT 900 /* Garbage collect every n number of cycles. */ 
+#define MAX_FRAME_POOL     64 /* Most frames a thread keeps for reuse.       */
 
 /* Threading is handled on the program level in the Furlow VM, for the most
  * part. Each thread has its own stacks and instruction pointer. After an
@@ -69,10 +72,20 @@ typedef struct FACT_thread {
   size_t (*traps)[2];    /* Trap stack. Delegates user error handling. */
   size_t num_traps;      /* Number of traps set.                       */ 
   FACT_error_t curr_err; /* The last error thrown.                     */
+  jmp_buf handle_err;    /* Jump to the error handler.                 */
+  jmp_buf recover;       /* When there are no other options.           */
 
   /* Virtual machine registers:                                 */
   FACT_t registers[T_REGISTERS]; /* NOT to be handled directly. */
 
+  /* Inline caches, indexed by instruction address:             */
+  struct FACT_icache *icache; /* Grown lazily as the program is. */
+  size_t icache_size;         /* Number of caches allocated.     */
+
+  /* Recycled activation scopes, linked through caller:       */
+  FACT_scope_t frame_pool;  /* Frames freed by RET_F.          */
+  size_t frame_pool_size;   /* Number of frames in the pool.   */
+
   /* Threading data: */
   enum T_FLAG {
     T_LIVE = 0, /* Thread is running. */
@@ -82,32 +95,76 @@ typedef struct FACT_thread {
   
   /* Internal thread information:                        */
   size_t thread_num;        /* Iternal thread ID number. */
-  pthread_t thread_id;      /* Pthreads representation.  */
-  struct FACT_thread *next; /* Next thread in the list.  */
 
-  /* Message queue for thread communication: */
+  /* Threads other than main are tasks on the worker pool (see
+   * FACT_sched.c). They run on a C stack of their own:
+   */
+  ucontext_t context;         /* Saved while the task is switched out. */
+  void *stack;                /* The task's C stack.                   */
+  struct FACT_worker *worker; /* Worker running the task, or NULL.     */
+
+  /* Tasks started from C run entry in place of the program. Any thread
+   * may wait for a task to die with FACT_sched_join:
+   */
+  void (*entry)(void *);           /* NULL for threads made by SPRT.     */
+  void *entry_arg;                 /* Passed to entry.                   */
+  bool failed;                     /* An error escaped, see curr_err.    */
+  bool joinable;                   /* Kept in the table until joined.    */
+  bool joined;                     /* Set by the thread that joins it.   */
+  FACT_t result;                   /* Return value of a spawned thread.  */
+  bool finished;                   /* Set once the task is released.    */
+  pthread_mutex_t join_lock;       /* Guards finished and joiners.       */
+  pthread_cond_t join_block;       /* Joiners that aren't tasks wait.    */
+  struct FACT_thread *joiners;     /* Parked tasks waiting for this one. */
+  struct FACT_thread *next_joiner; /* Next task in the same list.        */
+  struct FACT_thread *joining;     /* Thread this one is waiting for.    */
+
+  /* Message queue for thread communication. Any thread may push to
+   * it without locking, but only the owner may pop (see FACT_threads.c).
+   */
   pthread_cond_t msg_block;   /* Blocking to prevent busy-wait. */
-  pthread_mutex_t queue_lock;
+  pthread_mutex_t queue_lock; /* Only guards msg_block.         */
   struct FACT_thread_queue {
     size_t sender_id; /* The sender of the message.           */
-    FACT_num_t msg;   /* Only numerical values can be passed. */
+    FACT_t msg;       /* Shared if locked, otherwise a copy.  */
     struct FACT_thread_queue *next; /* Implemented as a linked list. */
-  } *root_message;
-  size_t num_messages;
+  } *msg_head, *msg_tail; /* Last message pushed, and the dummy before the next. */
+  size_t num_messages;    /* Updated atomically.                  */
+  bool msg_waiting;       /* Set while the owner sleeps on msg_block. */
+  bool msg_park;          /* Wake the owner with FACT_sched_wake.     */
 } *FACT_thread_t;
 
 /* Threading and stacks:                                                 */
-extern size_t num_threads;                 /* Number of threads.         */
-extern FACT_thread_t threads;              /* Thread data.               */
+extern size_t num_threads;                 /* Number of live threads.    */
 extern __thread FACT_thread_t curr_thread; /* Data specific to a thread. */
 
-/* Error recovery:                                            */
-extern __thread jmp_buf handle_err; /* Handles thrown errors. */ 
-extern __thread jmp_buf recover;    /* When no traps are set. */
+/* A thread ID is the thread's slot in the thread table, tagged with the
+ * number of times the slot has been reused above THREAD_SLOT_BITS.
+ */
+#define THREAD_SLOT_BITS  20
+#define THREAD_CHUNK_SIZE 256 /* Slots allocated at a time. */
+
+/* Thread table functions:                                               */
+FACT_thread_t Furlow_new_thread (size_t); /* Allocate a thread with an ID.  */
+void Furlow_add_thread (FACT_thread_t);    /* Give a thread a slot and ID. */
+FACT_thread_t Furlow_find_thread (size_t); /* NULL if it isn't in the table. */
+FACT_thread_t Furlow_get_thread (size_t);  /* NULL if it isn't live.       */
+bool Furlow_was_thread (size_t);           /* Check if an ID was ever used. */
+void Furlow_remove_thread (FACT_thread_t); /* Release a dead thread.       */
+void Furlow_forget_thread (FACT_thread_t); /* Free a dead thread's slot.   */
 
 /* Global variables: */
 extern FACT_table_t Furlow_globals;
 
+/* Constant globals and BIFs are also given a slot in a global vector, so
+ * that the compiler can bind to them directly with the GVAR instruction.
+ */
+struct Furlow_gslot {
+  char *name;    /* Name of the global.                                */
+  size_t hash;   /* Hash of the name.                                  */
+  FACT_t var;    /* The global's value, UNSET_TYPE until it's defined. */
+};
+
 #define THIS_OF(t) (t)->cstackp->this
 #define IP_OF(t)   (t)->cstackp->ip
 #define CURR_THIS  curr_thread->cstackp->this
@@ -129,10 +186,28 @@ void *Furlow_reg_val (int, FACT_type); /* Safely access a register. */
 
 /* Execution functions:                                      */
 void Furlow_run (); /* Run one cycle of the current program. */ 
+void *Furlow_thread_mask (void *); /* Run a thread until it stops. */
+FACT_t Furlow_call (FACT_scope_t, FACT_t *, size_t); /* Call a function from C. */
 
 /* Init functions:                                         */
 void Furlow_init_vm (); /* Initialize the virtual machine. */
 
+/* Global slot functions:                                                      */
+size_t Furlow_reserve_gslot (char *); /* Get or create a global's slot.         */
+long Furlow_find_gslot (char *);      /* Get a global's slot, or -1.            */
+void Furlow_bind_global (FACT_t);     /* Add a constant to the globals.         */
+
+/* Furlow_sym_arg: read a symbol operand of an instruction. Symbols are
+ * stored in the instruction as a pointer, see FACT_intern.
+ */
+static inline char *Furlow_sym_arg (char *arg)
+{
+  char *res;
+
+  memcpy (&res, arg, sizeof (char *));
+  return res;
+}
+
 /* Code handling functions:                                                 */
 void Furlow_add_instruction (char *); /* Add an instruction to the program. */
 inline void Furlow_lock_program ();   /* Wait for a chance and lock.        */